@@ -21,60 +21,1861 @@ Publishers, LogStore, Topic, Subscribers, Messages
 #include <memory>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <optional>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <span>
+#include <map>
+#include <random>
+#include <filesystem>
+#include <fstream>
+#include <cassert>
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 using namespace std;
 
 
+// Power of two size classes carved out of 64KB slabs, freed blocks go back on a per class free list and are reused.
+// Requests above the largest class fall back to the heap.
+class SlabPool {
+    static constexpr size_t SLAB_BYTES = 64 * 1024;
+    static constexpr array<size_t, 13> CLASS_SIZES = {64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 131072, 262144};
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    struct SizeClass {
+        mutex m;
+        FreeBlock *free = nullptr;
+        vector<unique_ptr<char[]>> slabs;
+    };
+    array<SizeClass, CLASS_SIZES.size()> classes;
+    atomic<size_t> reserved;
+    public:
+    static constexpr int HEAP = -1;
+
+    SlabPool():reserved(0) {}
+
+    static SlabPool &global() {
+        static SlabPool pool;
+        return pool;
+    }
+
+    void *allocate(size_t bytes, int &sizeClass) {
+        auto it = lower_bound(CLASS_SIZES.begin(), CLASS_SIZES.end(), bytes);
+        if (it == CLASS_SIZES.end()) {
+            sizeClass = HEAP;
+            return ::operator new(bytes);
+        }
+        sizeClass = it - CLASS_SIZES.begin();
+        auto &c = classes[sizeClass];
+        lock_guard<mutex> lock(c.m);
+        if (!c.free) {
+            size_t blockBytes = *it, slabBytes = max(SLAB_BYTES, blockBytes);
+            c.slabs.push_back(make_unique<char[]>(slabBytes));
+            reserved += slabBytes;
+            char *slab = c.slabs.back().get();
+            for(size_t offset = 0; offset + blockBytes <= slabBytes; offset += blockBytes) {
+                auto block = reinterpret_cast<FreeBlock*>(slab + offset);
+                block->next = c.free;
+                c.free = block;
+            }
+        }
+        auto block = c.free;
+        c.free = block->next;
+        return block;
+    }
+
+    void release(void *ptr, int sizeClass) {
+        if (sizeClass == HEAP) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto &c = classes[sizeClass];
+        auto block = static_cast<FreeBlock*>(ptr);
+        lock_guard<mutex> lock(c.m);
+        block->next = c.free;
+        c.free = block;
+    }
+
+    size_t reservedBytes() const {
+        return reserved;
+    }
+};
+
+
+// Immutable, intrusively reference counted message bytes. Copying a Payload only bumps the count, so every
+// subscriber queue shares one buffer. The buffer is gathered from one or more segments and keeps the segment
+// boundaries, segment(i) and slice() hand out views that stay valid while any Payload to the buffer is alive.
+// Layout of one allocation: [Header][uint32_t segmentEnds[segments]][bytes].
+class Payload {
+    struct Header {
+        atomic<uint32_t> refs;
+        uint32_t size;
+        uint32_t segments;
+        int sizeClass;
+        SlabPool *pool;
+    };
+    Header *header;
+
+    explicit Payload(Header *header):header(header) {}
+
+    const uint32_t *segmentEnds() const {
+        return reinterpret_cast<const uint32_t*>(header + 1);
+    }
+
+    const char *bytes() const {
+        return reinterpret_cast<const char*>(segmentEnds() + header->segments);
+    }
+
+    void release() {
+        if (header and header->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            auto pool = header->pool;
+            int sizeClass = header->sizeClass;
+            header->~Header();
+            pool->release(header, sizeClass);
+        }
+        header = nullptr;
+    }
+
+    public:
+    Payload():header(nullptr) {}
+
+    static Payload gather(initializer_list<string_view> parts, SlabPool &pool = SlabPool::global()) {
+        return gather(parts.begin(), parts.size(), pool);
+    }
+
+    static Payload gather(const vector<string_view> &parts, SlabPool &pool = SlabPool::global()) {
+        return gather(parts.data(), parts.size(), pool);
+    }
+
+    static Payload gather(const string_view *parts, size_t count, SlabPool &pool) {
+        size_t size = 0;
+        for(size_t i = 0; i < count; i++) size += parts[i].size();
+        size_t bytes = sizeof(Header) + count * sizeof(uint32_t) + size;
+        int sizeClass;
+        void *block = pool.allocate(bytes, sizeClass);
+        auto header = new (block) Header{{1}, (uint32_t)size, (uint32_t)count, sizeClass, &pool};
+        auto ends = reinterpret_cast<uint32_t*>(header + 1);
+        char *out = reinterpret_cast<char*>(ends + count);
+        uint32_t end = 0;
+        for(size_t i = 0; i < count; i++) {
+            memcpy(out + end, parts[i].data(), parts[i].size());
+            end += parts[i].size();
+            ends[i] = end;
+        }
+        return Payload(header);
+    }
+
+    Payload(const Payload &other):header(other.header) {
+        if (header) header->refs.fetch_add(1, memory_order_relaxed);
+    }
+
+    Payload(Payload &&other) noexcept:header(other.header) {
+        other.header = nullptr;
+    }
+
+    Payload &operator=(const Payload &other) {
+        if (other.header) other.header->refs.fetch_add(1, memory_order_relaxed);
+        release();
+        header = other.header;
+        return *this;
+    }
+
+    Payload &operator=(Payload &&other) noexcept {
+        if (this != &other) {
+            release();
+            header = other.header;
+            other.header = nullptr;
+        }
+        return *this;
+    }
+
+    ~Payload() {
+        release();
+    }
+
+    size_t size() const {
+        return header ? header->size : 0;
+    }
+
+    string_view view() const {
+        return header ? string_view(bytes(), header->size) : string_view();
+    }
+
+    string_view slice(size_t offset, size_t length) const {
+        return view().substr(offset, length);
+    }
+
+    size_t segmentCount() const {
+        return header ? header->segments : 0;
+    }
+
+    string_view segment(size_t i) const {
+        uint32_t begin = i == 0 ? 0 : segmentEnds()[i - 1];
+        return string_view(bytes() + begin, segmentEnds()[i] - begin);
+    }
+
+    uint32_t refCount() const {
+        return header ? header->refs.load() : 0;
+    }
+};
+
+
+// sequence is assigned by the topic when the message is delivered, starting from 1 and increasing by one per topic.
+// A pattern subscriber gets messages for names without a topic numbered by its own counter instead.
+// topic is the name it was published to through a Broker, useful for pattern subscribers, null otherwise.
 struct Message {
-    string message;
-    int id;
-    Message(const string &msg): message(msg),id(rand() % 1000) {}
+    Payload payload;
+    uint64_t sequence;
+    chrono::steady_clock::time_point publishedAt;
+    shared_ptr<const string> topic;
+    Message(): sequence(0) {}
+    Message(string_view msg, SlabPool &pool = SlabPool::global()): payload(Payload::gather({msg}, pool)), sequence(0) {}
+    explicit Message(Payload payload): payload(std::move(payload)), sequence(0) {}
+
+    string_view text() const {
+        return payload.view();
+    }
+};
+
+
+enum class OverflowPolicy {
+    DROP,     // Drop the new message when the subscriber queue is full
+    BLOCK,    // Wait for the subscriber to make room, backpressure reaches publishers through the topic log
+    CONFLATE  // Keep only the latest message once the subscriber falls behind
+};
+
+
+// Bounded single producer single consumer ring, the producer is the topic fan-out thread and the consumer
+// is whichever dispatcher worker currently drains the subscriber.
+template<typename T>
+class SpscQueue {
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+    public:
+    explicit SpscQueue(size_t capacity):head(0), tail(0) {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool push(const T &value) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) > mask) return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire)) return false;
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+    }
+};
+
+
+// Worker pool for subscriber callbacks, submitAfter runs a task once its delay has passed (used for batch linger).
+class Dispatcher {
+    struct Delayed {
+        chrono::steady_clock::time_point due;
+        function<void()> task;
+    };
+    struct Later {
+        bool operator()(const Delayed &a, const Delayed &b) const {
+            return a.due > b.due;
+        }
+    };
+
+    vector<thread> pool;
+    queue<function<void()>> tasks;
+    priority_queue<Delayed, vector<Delayed>, Later> delayed;
+    mutex m;
+    condition_variable cv;
+    bool stop;
+    public:
+    explicit Dispatcher(int threads):stop(false) {
+        for(int i = 0; i < threads; i++) {
+            pool.emplace_back([this]() -> void {
+                while(1) {
+                    unique_lock<mutex> lock(m);
+                    while(1) {
+                        if (stop) return;
+                        auto now = chrono::steady_clock::now();
+                        while(!delayed.empty() and delayed.top().due <= now) {
+                            tasks.push(delayed.top().task);
+                            delayed.pop();
+                        }
+                        if (!tasks.empty()) break;
+                        if (delayed.empty()) cv.wait(lock);
+                        else cv.wait_until(lock, delayed.top().due);
+                    }
+                    auto task = std::move(tasks.front());
+                    tasks.pop();
+                    lock.unlock();
+                    task();
+                }
+            });
+        }
+    }
+
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> lock(m);
+            tasks.push(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+    void submitAfter(chrono::microseconds delay, function<void()> task) {
+        {
+            lock_guard<mutex> lock(m);
+            delayed.push({chrono::steady_clock::now() + delay, std::move(task)});
+        }
+        cv.notify_one();
+    }
+
+    ~Dispatcher() {
+        {
+            lock_guard<mutex> lock(m);
+            stop = true;
+        }
+        cv.notify_all();
+        for(auto &t: pool) t.join();
+    }
+};
+
+
+using Callback = function<void(const Message&msg)>;
+using BatchCallback = function<void(span<const Message> batch)>;
+
+
+// A batch is handed over once it holds maxBatch messages or its oldest message is linger old.
+struct BatchOptions {
+    size_t maxBatch = 64;
+    chrono::microseconds linger = chrono::microseconds(1000);
+};
+
+
+struct Subscriber {
+    static constexpr int DRAIN_BATCH = 64;
+
+    string name;
+    Callback callback;
+    // Set for batch subscribers, which get whole batches instead of one callback per message.
+    BatchCallback batchCallback;
+    BatchOptions batchOptions;
+    OverflowPolicy policy;
+    Dispatcher *dispatcher;
+    SpscQueue<Message> queue;
+    mutex conflatedMutex;
+    optional<Message> conflated;
+    atomic<bool> hasConflated;
+    // Set while a drain task is queued or running, so at most one worker consumes the queue.
+    atomic<bool> scheduled;
+    atomic<bool> lingerArmed;
+    atomic<bool> active;
+    // Pattern subscribers are fed by the fan-out thread of every matching topic, which serialize on `producers`.
+    bool sharedProducers;
+    mutex producers;
+    // Numbers the messages a broker hands over directly, guarded by producers.
+    uint64_t directSequence;
+    // Held while callbacks run, deactivate waits on it so no callback is running or starts once it returns.
+    mutex inFlight;
+    // Worker running the callbacks, so a callback that removes its own subscriber does not wait on itself.
+    atomic<thread::id> runner;
+    atomic<size_t> delivered;
+    atomic<size_t> dropped;
+    // Batch being assembled, only touched by the worker that holds `scheduled`.
+    vector<Message> pending;
+    atomic<size_t> pendingCount;
+
+    Subscriber(const string &name, Callback callback, OverflowPolicy policy, Dispatcher *dispatcher, size_t capacity):
+    name(name), callback(std::move(callback)), policy(policy), dispatcher(dispatcher), queue(capacity),
+    hasConflated(false), scheduled(false), lingerArmed(false), active(true), sharedProducers(false), directSequence(0), delivered(0), dropped(0), pendingCount(0) {}
+
+    Subscriber(const string &name, BatchCallback batchCallback, BatchOptions batchOptions, OverflowPolicy policy, Dispatcher *dispatcher, size_t capacity):
+    Subscriber(name, Callback(), policy, dispatcher, capacity) {
+        this->batchCallback = std::move(batchCallback);
+        this->batchOptions = batchOptions;
+        this->batchOptions.maxBatch = max<size_t>(1, batchOptions.maxBatch);
+        pending.reserve(this->batchOptions.maxBatch);
+    }
+
+    // Runs `deliver` with the in-flight guard held, the callbacks it makes check active first.
+    template<typename Deliver>
+    void guarded(Deliver &&deliver) {
+        lock_guard<mutex> lock(inFlight);
+        runner = this_thread::get_id();
+        deliver();
+        runner = thread::id();
+    }
+
+    void deactivate() {
+        active = false;
+        if (runner.load() == this_thread::get_id()) return;
+        lock_guard<mutex> lock(inFlight);
+    }
+
+    bool idle() const {
+        return queue.empty() and !hasConflated and !scheduled and pendingCount == 0;
+    }
+
+    static void schedule(const shared_ptr<Subscriber> &sub) {
+        if (sub->scheduled.exchange(true)) return;
+        sub->dispatcher->submit([sub]() -> void {
+            if (sub->batchCallback) drainBatch(sub);
+            else drain(sub);
+        });
+    }
+
+    static optional<Message> takeConflated(const shared_ptr<Subscriber> &sub) {
+        optional<Message> latest;
+        lock_guard<mutex> lock(sub->conflatedMutex);
+        latest.swap(sub->conflated);
+        sub->hasConflated = false;
+        return latest;
+    }
+
+    static void drain(const shared_ptr<Subscriber> &sub) {
+        sub->guarded([&]() -> void {
+            Message msg;
+            int handled = 0;
+            while(handled < DRAIN_BATCH and sub->queue.pop(msg)) {
+                if (sub->active) sub->callback(msg);
+                sub->delivered++;
+                handled++;
+            }
+            // The conflated slot is always newer than anything in the ring, so it goes last.
+            if (handled < DRAIN_BATCH and sub->hasConflated) {
+                auto latest = takeConflated(sub);
+                if (latest and sub->active) sub->callback(*latest);
+                if (latest) sub->delivered++;
+            }
+        });
+        sub->scheduled = false;
+        if (!sub->queue.empty() or sub->hasConflated) schedule(sub);
+    }
+
+    static void drainBatch(const shared_ptr<Subscriber> &sub) {
+        auto &pending = sub->pending;
+        auto &options = sub->batchOptions;
+        Message msg;
+        while(pending.size() < options.maxBatch and sub->queue.pop(msg)) pending.push_back(std::move(msg));
+        if (pending.size() < options.maxBatch and sub->queue.empty() and sub->hasConflated) {
+            if (auto latest = takeConflated(sub)) pending.push_back(std::move(*latest));
+        }
+        sub->pendingCount = pending.size();
+
+        auto age = pending.empty() ? chrono::microseconds(0) :
+            chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - pending.front().publishedAt);
+        if (!pending.empty() and (pending.size() >= options.maxBatch or age >= options.linger or !sub->active)) {
+            sub->guarded([&]() -> void {
+                if (sub->active) sub->batchCallback(span<const Message>(pending));
+            });
+            sub->delivered += pending.size();
+            pending.clear();
+            sub->pendingCount = 0;
+        }
+
+        // pending belongs to the next drain as soon as scheduled is released.
+        bool partial = !pending.empty();
+        sub->scheduled = false;
+        if (!sub->queue.empty() or sub->hasConflated) {
+            schedule(sub);
+        } else if (partial and !sub->lingerArmed.exchange(true)) {
+            // Partial batch, come back when its oldest message reaches the linger time.
+            sub->dispatcher->submitAfter(options.linger - age, [sub]() -> void {
+                sub->lingerArmed = false;
+                schedule(sub);
+            });
+        }
+    }
+
+    // Only called from topic fan-out threads, more than one only for shared producers.
+    void enqueue(const Message &msg, const shared_ptr<Subscriber> &self) {
+        unique_lock<mutex> lock(producers, defer_lock);
+        if (sharedProducers) lock.lock();
+        push(msg, self);
+    }
+
+    // Messages a broker publishes to a name without a topic, handed over by the publisher. There is no topic to
+    // number them, so they get the subscriber's own sequence, in the order they reach its queue.
+    void enqueueDirect(span<const Message> msgs, const shared_ptr<Subscriber> &self) {
+        lock_guard<mutex> lock(producers);
+        for(auto &msg: msgs) {
+            Message numbered = msg;
+            numbered.sequence = ++directSequence;
+            push(numbered, self);
+        }
+    }
+
+    void push(const Message &msg, const shared_ptr<Subscriber> &self) {
+        switch (policy) {
+            case OverflowPolicy::DROP:
+                if (!queue.push(msg)) dropped++;
+                return;
+            case OverflowPolicy::BLOCK:
+                while(!queue.push(msg)) {
+                    if (!active) return;
+                    schedule(self);
+                    this_thread::yield();
+                }
+                return;
+            case OverflowPolicy::CONFLATE:
+                // Once something is conflated later messages must not overtake it through the ring.
+                if (hasConflated or !queue.push(msg)) {
+                    lock_guard<mutex> conflatedLock(conflatedMutex);
+                    if (conflated) dropped++;
+                    conflated = msg;
+                    hasConflated = true;
+                }
+                return;
+        }
+    }
+};
+
+
+// Bounded multi producer single consumer queue (Vyukov style sequence per slot), used as the topic log
+// so publishers only do a CAS on the tail.
+template<typename T>
+class MpscQueue {
+    struct Slot {
+        atomic<size_t> sequence;
+        T value;
+    };
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> tail;
+    alignas(64) atomic<size_t> head;
+    public:
+    explicit MpscQueue(size_t capacity):tail(0), head(0) {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        slots = make_unique<Slot[]>(size);
+        for(size_t i = 0; i < size; i++) slots[i].sequence.store(i, memory_order_relaxed);
+        mask = size - 1;
+    }
+
+    bool tryPush(const T &value) {
+        size_t pos = tail.load(memory_order_relaxed);
+        while(1) {
+            Slot &slot = slots[pos & mask];
+            size_t sequence = slot.sequence.load(memory_order_acquire);
+            auto diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claims count consecutive slots with one CAS, all or nothing. The consumer frees slots in order,
+    // so once the last slot of the range is free every slot before it is free too.
+    bool tryPush(const T *values, size_t count) {
+        if (count == 0) return true;
+        if (count > capacity()) return false;
+        size_t pos = tail.load(memory_order_relaxed);
+        while(1) {
+            size_t last = pos + count - 1;
+            size_t sequence = slots[last & mask].sequence.load(memory_order_acquire);
+            auto diff = (intptr_t)sequence - (intptr_t)last;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + count, memory_order_relaxed)) {
+                    for(size_t i = 0; i < count; i++) {
+                        Slot &slot = slots[(pos + i) & mask];
+                        slot.value = values[i];
+                        slot.sequence.store(pos + i + 1, memory_order_release);
+                    }
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    // Single consumer only.
+    bool pop(T &value) {
+        size_t pos = head.load(memory_order_relaxed);
+        Slot &slot = slots[pos & mask];
+        if (slot.sequence.load(memory_order_acquire) != pos + 1) return false;
+        value = std::move(slot.value);
+        slot.sequence.store(pos + mask + 1, memory_order_release);
+        head.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+    }
+};
+
+
+struct DurabilityOptions {
+    string dir;
+    size_t segmentBytes = 64 << 20;
+    // fsync once this many messages are unsynced, once syncInterval passed since the last fsync,
+    // or when the topic goes idle, whichever comes first.
+    size_t syncEveryMessages = 4096;
+    chrono::milliseconds syncInterval = chrono::milliseconds(10);
+};
+
+
+// Segmented append only log for a durable topic. Segment files are named after the first sequence they hold,
+// records are [u64 sequence][u32 length][u32 checksum][payload bytes]. The sequence -> offset index of every
+// segment is kept in memory and rebuilt by scanning on open, a torn record at the tail is truncated away.
+// Appends and syncs come from the topic fan-out thread only, replay and offset commits may come from any thread.
+class DurableLog {
+    static constexpr size_t RECORD_HEADER = 16;
+
+    struct Segment {
+        uint64_t baseSequence;
+        filesystem::path path;
+        uint64_t size;
+        vector<uint64_t> offsets;
+    };
+
+    DurabilityOptions options;
+    mutable mutex indexMutex;
+    vector<Segment> segments;
+    uint64_t last;
+    int fd;
+    string buffer;
+    size_t unsynced;
+    chrono::steady_clock::time_point lastSync;
+
+    mutable mutex offsetsMutex;
+    map<string, uint64_t> committed;
+    bool offsetsDirty;
+
+    static uint32_t checksum(string_view data) {
+        uint32_t h = 2166136261u;
+        for(unsigned char c: data) h = (h ^ c) * 16777619u;
+        return h;
+    }
+
+    filesystem::path segmentPath(uint64_t baseSequence) const {
+        string name = to_string(baseSequence);
+        return filesystem::path(options.dir) / (string(20 - name.size(), '0') + name + ".log");
+    }
+
+    filesystem::path offsetsPath() const {
+        return filesystem::path(options.dir) / "offsets";
+    }
+
+    // Walks the records in a mapped segment, stops at the first incomplete or corrupt one.
+    template<typename F>
+    static uint64_t scan(const char *data, uint64_t size, uint64_t offset, F &&visit) {
+        while(offset + RECORD_HEADER <= size) {
+            uint64_t sequence;
+            uint32_t length, sum;
+            memcpy(&sequence, data + offset, 8);
+            memcpy(&length, data + offset + 8, 4);
+            memcpy(&sum, data + offset + 12, 4);
+            if (offset + RECORD_HEADER + length > size) break;
+            string_view payload(data + offset + RECORD_HEADER, length);
+            if (checksum(payload) != sum) break;
+            visit(sequence, offset, payload);
+            offset += RECORD_HEADER + length;
+        }
+        return offset;
+    }
+
+    template<typename F>
+    static void withMapping(const filesystem::path &path, uint64_t size, F &&body) {
+        if (size == 0) return;
+        int readFd = ::open(path.c_str(), O_RDONLY);
+        if (readFd < 0) return;
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, readFd, 0);
+        ::close(readFd);
+        if (data == MAP_FAILED) return;
+        madvise(data, size, MADV_SEQUENTIAL);
+        body(static_cast<const char*>(data));
+        munmap(data, size);
+    }
+
+    void recover() {
+        vector<filesystem::path> paths;
+        for(auto &entry: filesystem::directory_iterator(options.dir)) {
+            if (entry.path().extension() == ".log") paths.push_back(entry.path());
+        }
+        sort(paths.begin(), paths.end());
+        for(auto &path: paths) {
+            Segment segment{stoull(path.stem().string()), path, 0, {}};
+            uint64_t fileSize = filesystem::file_size(path);
+            withMapping(path, fileSize, [&](const char *data) {
+                segment.size = scan(data, fileSize, 0, [&](uint64_t sequence, uint64_t offset, string_view) {
+                    segment.offsets.push_back(offset);
+                    last = sequence;
+                });
+            });
+            if (segment.size != fileSize) filesystem::resize_file(path, segment.size);
+            segments.push_back(std::move(segment));
+        }
+
+        // One line per group: the length of its name, the name and the offset, so names may hold any byte.
+        ifstream in(offsetsPath());
+        size_t length;
+        uint64_t sequence;
+        while(in >> length and in.get() == ' ') {
+            string group(length, '\0');
+            if (!in.read(group.data(), length) or !(in >> sequence)) break;
+            committed[group] = sequence;
+        }
+    }
+
+    void openSegment(uint64_t baseSequence) {
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+        auto path = segmentPath(baseSequence);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        lock_guard<mutex> lock(indexMutex);
+        segments.push_back({baseSequence, path, 0, {}});
+    }
+
+    void reopenTail() {
+        auto &tail = segments.back();
+        fd = ::open(tail.path.c_str(), O_WRONLY | O_APPEND);
+    }
+
+    void writeBuffer(vector<uint64_t> &pendingOffsets) {
+        size_t written = 0;
+        while(written < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (n <= 0) {
+                if (n < 0 and errno == EINTR) continue;
+                throw runtime_error("topic log write failed: " + string(strerror(errno)));
+            }
+            written += n;
+        }
+        lock_guard<mutex> lock(indexMutex);
+        auto &tail = segments.back();
+        tail.offsets.insert(tail.offsets.end(), pendingOffsets.begin(), pendingOffsets.end());
+        tail.size += buffer.size();
+        buffer.clear();
+        pendingOffsets.clear();
+    }
+
+    void writeOffsets() {
+        map<string, uint64_t> snapshot;
+        {
+            lock_guard<mutex> lock(offsetsMutex);
+            if (!offsetsDirty) return;
+            snapshot = committed;
+            offsetsDirty = false;
+        }
+        string text;
+        for(auto &[group, sequence]: snapshot) text += to_string(group.size()) + " " + group + " " + to_string(sequence) + "\n";
+        // The new file is durable before it replaces the old one, and the rename is durable before returning,
+        // so a crash leaves either the previous or the new offsets.
+        auto fail = [&](const string &what) {
+            lock_guard<mutex> lock(offsetsMutex);
+            offsetsDirty = true;
+            throw runtime_error("cannot " + what + " topic offsets: " + string(strerror(errno)));
+        };
+        auto tmp = offsetsPath();
+        tmp += ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) fail("create");
+        size_t written = 0;
+        while(written < text.size()) {
+            ssize_t n = ::write(out, text.data() + written, text.size() - written);
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) {
+                ::close(out);
+                fail("write");
+            }
+            written += n;
+        }
+        if (::fsync(out) != 0) {
+            ::close(out);
+            fail("sync");
+        }
+        if (::close(out) != 0) fail("write");
+        if (::rename(tmp.c_str(), offsetsPath().c_str()) != 0) fail("replace");
+        int dir = ::open(options.dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir < 0) fail("sync the directory of");
+        int synced = ::fsync(dir);
+        ::close(dir);
+        if (synced != 0) fail("sync the directory of");
+    }
+
+    public:
+    explicit DurableLog(DurabilityOptions options):options(std::move(options)), last(0), fd(-1), unsynced(0),
+    lastSync(chrono::steady_clock::now()), offsetsDirty(false) {
+        filesystem::create_directories(this->options.dir);
+        recover();
+        if (segments.empty()) openSegment(1);
+        else reopenTail();
+        if (fd < 0) throw runtime_error("cannot open topic log in " + this->options.dir);
+    }
+
+    ~DurableLog() {
+        try {
+            sync();
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    uint64_t lastSequence() const {
+        lock_guard<mutex> lock(indexMutex);
+        return last;
+    }
+
+    void append(const vector<Message> &batch) {
+        vector<uint64_t> pendingOffsets;
+        uint64_t tailSize;
+        {
+            lock_guard<mutex> lock(indexMutex);
+            tailSize = segments.back().size;
+        }
+        for(auto &msg: batch) {
+            if (tailSize + buffer.size() >= options.segmentBytes) {
+                writeBuffer(pendingOffsets);
+                openSegment(msg.sequence);
+                tailSize = 0;
+            }
+            string_view payload = msg.text();
+            uint32_t length = payload.size(), sum = checksum(payload);
+            pendingOffsets.push_back(tailSize + buffer.size());
+            buffer.append((const char*)&msg.sequence, 8);
+            buffer.append((const char*)&length, 4);
+            buffer.append((const char*)&sum, 4);
+            buffer.append(payload);
+        }
+        writeBuffer(pendingOffsets);
+        {
+            lock_guard<mutex> lock(indexMutex);
+            if (!batch.empty()) last = batch.back().sequence;
+        }
+        unsynced += batch.size();
+        if (unsynced >= options.syncEveryMessages or chrono::steady_clock::now() - lastSync >= options.syncInterval) sync();
+    }
+
+    void sync() {
+        if (unsynced > 0 and fd >= 0) {
+            ::fdatasync(fd);
+            unsynced = 0;
+        }
+        lastSync = chrono::steady_clock::now();
+        writeOffsets();
+    }
+
+    // Calls fn in sequence order for every record from `from` up to the end of the log at the time of the call.
+    // Segments are mapped read only and walked front to back, the index only locates the first record.
+    void replay(uint64_t from, const function<void(const Message&)> &fn) const {
+        struct Range {
+            filesystem::path path;
+            uint64_t size;
+            uint64_t start;
+        };
+        vector<Range> ranges;
+        {
+            lock_guard<mutex> lock(indexMutex);
+            for(auto &segment: segments) {
+                uint64_t end = segment.baseSequence + segment.offsets.size();
+                if (end <= from) continue;
+                uint64_t start = from > segment.baseSequence ? segment.offsets[from - segment.baseSequence] : 0;
+                ranges.push_back({segment.path, segment.size, start});
+            }
+        }
+        for(auto &range: ranges) {
+            withMapping(range.path, range.size, [&](const char *data) {
+                scan(data, range.size, range.start, [&](uint64_t sequence, uint64_t, string_view payload) {
+                    Message msg(payload);
+                    msg.sequence = sequence;
+                    fn(msg);
+                });
+            });
+        }
+    }
+
+    // Persisted with the next sync.
+    void commit(const string &group, uint64_t sequence) {
+        lock_guard<mutex> lock(offsetsMutex);
+        auto &offset = committed[group];
+        if (sequence > offset) {
+            offset = sequence;
+            offsetsDirty = true;
+        }
+    }
+
+    uint64_t committedOffset(const string &group) const {
+        lock_guard<mutex> lock(offsetsMutex);
+        auto it = committed.find(group);
+        return it == committed.end() ? 0 : it->second;
+    }
 };
 
 
+// A flat vector keeps the copy per subscription change cheap, lookups by name are only on the write path.
+using SubscriberSet = vector<shared_ptr<Subscriber>>;
+
+
+// Publishing appends to the lock free topic log and returns, a per topic fan-out thread copies each logged message
+// into every subscriber queue and dispatcher workers run the callbacks.
+// The subscriber set is copy on write: writers serialize on a mutex, copy, and swap in the new snapshot,
+// the fan-out thread only reloads it when the version changes. A message published after addSub returns
+// reaches the new subscriber, and once removeSub returns no callback of that subscriber is running or starts (a
+// callback removing its own subscriber only stops later ones).
+// Subscribers of broker patterns matching the topic name are a second set, owned by the broker and delivered the same
+// way with the topic's own sequence numbers.
+// A durable topic also appends every batch to a DurableLog before handing it to subscribers, so consumer groups
+// can commit offsets and late or restarted subscribers catch up with subscribeFrom.
+// When the log cannot be written the topic fails: it stops delivering and publish throws the error.
+// The dispatcher has to outlive the topic and any work it queued.
 struct Topic {
-    Topic(const string &name): name(name) {}
-    using Callback = function<void(const Message&msg)>;
+    Topic(const string &name, Dispatcher &dispatcher, size_t logCapacity = 1 << 12):
+    name(name), dispatcher(dispatcher), log(logCapacity), published(0), subscribersVersion(0), fanningOut(false), stopping(false), failed(false), lastSequence(0) {
+        subscribers.store(make_shared<const SubscriberSet>());
+        patternSubscribers.store(make_shared<const SubscriberSet>());
+        fanOutThread = thread([this]() -> void { fanOut(); });
+    }
+
+    Topic(const string &name, Dispatcher &dispatcher, DurabilityOptions durability, size_t logCapacity = 1 << 12):
+    name(name), dispatcher(dispatcher), log(logCapacity), published(0), subscribersVersion(0), fanningOut(false), stopping(false), failed(false), lastSequence(0) {
+        subscribers.store(make_shared<const SubscriberSet>());
+        patternSubscribers.store(make_shared<const SubscriberSet>());
+        durable = make_unique<DurableLog>(std::move(durability));
+        lastSequence = durable->lastSequence();
+        fanOutThread = thread([this]() -> void { fanOut(); });
+    }
 
     string name;
-    unordered_map<string, Callback> subscribers;
-    void addSub(const string &subscriber, Callback callback) {
-        if (subscribers.find(subscriber) != subscribers.end()) return;
-        subscribers[subscriber] = callback;
+
+    void addSub(const string &subscriber, Callback callback, OverflowPolicy policy = OverflowPolicy::DROP, size_t queueCapacity = 256) {
+        addSubscriber(make_shared<Subscriber>(subscriber, std::move(callback), policy, &dispatcher, queueCapacity));
+    }
+
+    void addBatchSub(const string &subscriber, BatchCallback callback, BatchOptions options = BatchOptions(), OverflowPolicy policy = OverflowPolicy::BLOCK, size_t queueCapacity = 1024) {
+        addSubscriber(make_shared<Subscriber>(subscriber, std::move(callback), options, policy, &dispatcher, queueCapacity));
     }
 
+    // Waits for a callback of the subscriber that is running on another thread, outside the writers lock so that
+    // callback may still change subscriptions.
     void removeSub(const string &subscriber) {
-        if (subscribers.find(subscriber) == subscribers.end()) return;
-        subscribers.erase(subscriber);
+        shared_ptr<Subscriber> sub;
+        {
+            lock_guard<mutex> lock(writersMutex);
+            auto current = subscribers.load();
+            sub = findSub(*current, subscriber);
+            if (!sub) return;
+            auto next = make_shared<SubscriberSet>(*current);
+            next->erase(find(next->begin(), next->end(), sub));
+            subscribers.store(std::move(next));
+            subscribersVersion++;
+        }
+        sub->deactivate();
     }
 
-    void notify(const Message& msg) {
-        for(auto &[k, cb]: subscribers) {
-            cb(msg);
+    // Subscribes `group` and first replays everything after its committed offset from the durable log.
+    // Live messages are held back until the replay has caught up, then delivery continues without gaps
+    // or duplicates. Returns the number of replayed messages, a topic that is not durable just subscribes.
+    size_t subscribeFrom(const string &group, Callback callback, OverflowPolicy policy = OverflowPolicy::BLOCK, size_t queueCapacity = 256) {
+        if (!durable) {
+            addSub(group, std::move(callback), policy, queueCapacity);
+            return 0;
         }
+        struct CatchUp {
+            mutex m;
+            bool catchingUp = true;
+            uint64_t lastDelivered = 0;
+        };
+        auto state = make_shared<CatchUp>();
+        state->lastDelivered = durable->committedOffset(group);
+        addSub(group, [state, callback](const Message &msg) -> void {
+            lock_guard<mutex> lock(state->m);
+            if (state->catchingUp or msg.sequence <= state->lastDelivered) return;
+            state->lastDelivered = msg.sequence;
+            callback(msg);
+        }, policy, queueCapacity);
+
+        // Live messages reach the subscriber only after they are in the durable log, so whatever the live path
+        // skipped while catching up is picked up by the final replay, done under the handoff lock.
+        size_t replayed = 0;
+        auto deliver = [&](const Message &msg) -> void {
+            if (msg.sequence <= state->lastDelivered) return;
+            state->lastDelivered = msg.sequence;
+            callback(msg);
+            replayed++;
+        };
+        durable->replay(state->lastDelivered + 1, deliver);
+        lock_guard<mutex> lock(state->m);
+        durable->replay(state->lastDelivered + 1, deliver);
+        state->catchingUp = false;
+        return replayed;
     }
+
+    void commit(const string &group, uint64_t sequence) {
+        if (durable) durable->commit(group, sequence);
+    }
+
+    uint64_t committedOffset(const string &group) const {
+        return durable ? durable->committedOffset(group) : 0;
+    }
+
+    // Throws once the durable log failed, messages published before that may be lost.
+    void checkFailed() const {
+        if (failed.load(memory_order_acquire)) throw runtime_error(failure);
+    }
+
     void publish(const Message& msg) {
-        notify(msg);
+        checkFailed();
+        Message logged = msg;
+        logged.publishedAt = chrono::steady_clock::now();
+        // A full log pushes back on the publisher.
+        while(!log.tryPush(logged)) this_thread::yield();
+        published.fetch_add(1, memory_order_release);
+        published.notify_one();
+    }
+
+    // One CAS on the log and one wakeup for the whole batch instead of one per message.
+    void publishBatch(span<const Message> msgs) {
+        checkFailed();
+        auto now = chrono::steady_clock::now();
+        vector<Message> stamped(msgs.begin(), msgs.end());
+        for(auto &msg: stamped) msg.publishedAt = now;
+        size_t chunk = log.capacity() / 2;
+        for(size_t start = 0; start < stamped.size(); start += chunk) {
+            size_t count = min(chunk, stamped.size() - start);
+            while(!log.tryPush(stamped.data() + start, count)) this_thread::yield();
+            published.fetch_add(count, memory_order_release);
+            published.notify_one();
+        }
+    }
+
+    // Waits until everything published so far has been handed to every subscriber callback.
+    void flush() {
+        while(!log.empty() or fanningOut) this_thread::yield();
+        for(auto &sub: *subscribers.load()) {
+            while(!sub->idle()) this_thread::yield();
+        }
+        for(auto &sub: *patternSubscribers.load()) {
+            while(!sub->idle()) this_thread::yield();
+        }
+    }
+
+    size_t subscriberCount() const {
+        return subscribers.load()->size();
+    }
+
+    size_t dropped(const string &subscriber) const {
+        auto sub = findSub(*subscribers.load(), subscriber);
+        return sub ? sub->dropped.load() : 0;
+    }
+
+    ~Topic() {
+        stopping = true;
+        published.fetch_add(1, memory_order_release);
+        published.notify_one();
+        fanOutThread.join();
+    }
+
+    // Replaces the pattern subscribers, messages published after it returns reach the new set.
+    void setPatternSubscribers(shared_ptr<const SubscriberSet> subs) {
+        lock_guard<mutex> lock(writersMutex);
+        patternSubscribers.store(std::move(subs));
+        subscribersVersion++;
     }
 
+    private:
+    void addSubscriber(shared_ptr<Subscriber> sub) {
+        lock_guard<mutex> lock(writersMutex);
+        auto current = subscribers.load();
+        if (findSub(*current, sub->name)) return;
+        auto next = make_shared<SubscriberSet>(*current);
+        next->push_back(std::move(sub));
+        subscribers.store(std::move(next));
+        subscribersVersion++;
+    }
+
+    static shared_ptr<Subscriber> findSub(const SubscriberSet &set, const string &name) {
+        for(auto &sub: set) {
+            if (sub->name == name) return sub;
+        }
+        return nullptr;
+    }
+
+    Dispatcher &dispatcher;
+    mutex writersMutex;
+    atomic<shared_ptr<const SubscriberSet>> subscribers;
+    atomic<shared_ptr<const SubscriberSet>> patternSubscribers;
+
+    MpscQueue<Message> log;
+    atomic<uint64_t> published;
+    atomic<uint64_t> subscribersVersion;
+    atomic<bool> fanningOut;
+    atomic<bool> stopping;
+    // Set once by the fan-out thread when the durable log fails, failure is written before it.
+    atomic<bool> failed;
+    string failure;
+    // Only touched by the fan-out thread, which sees messages in log order.
+    uint64_t lastSequence;
+    unique_ptr<DurableLog> durable;
+    thread fanOutThread;
+
+    // An I/O error of the durable log fails the topic instead of escaping the fan-out thread.
+    template<typename F>
+    void guardDurable(F &&f) {
+        try {
+            f();
+        } catch (const exception &e) {
+            failure = "topic " + name + " failed: " + e.what();
+            failed.store(true, memory_order_release);
+        }
+    }
+
+    void fanOut() {
+        constexpr size_t MAX_BATCH = 1024;
+        vector<Message> batch;
+        shared_ptr<const SubscriberSet> subs, patternSubs;
+        uint64_t version = -1;
+        while(1) {
+            uint64_t seen = published.load(memory_order_acquire);
+            fanningOut = true;
+            Message msg;
+            while(batch.size() < MAX_BATCH and log.pop(msg)) {
+                msg.sequence = ++lastSequence;
+                batch.push_back(std::move(msg));
+            }
+            if (batch.empty()) {
+                if (durable and !failed) guardDurable([&]() -> void { durable->sync(); });
+                fanningOut = false;
+                if (stopping) return;
+                published.wait(seen, memory_order_acquire);
+                continue;
+            }
+
+            if (durable and !failed) guardDurable([&]() -> void { durable->append(batch); });
+            // Nothing that could not be logged is delivered, later messages are drained so publishers do not block.
+            if (failed) {
+                batch.clear();
+                fanningOut = false;
+                continue;
+            }
+
+            // Loaded after popping, so the batch sees every subscription that finished before its messages were published.
+            if (subscribersVersion.load() != version) {
+                version = subscribersVersion.load();
+                subs = subscribers.load();
+                patternSubs = patternSubscribers.load();
+            }
+            for(auto &m: batch) {
+                for(auto &sub: *subs) sub->enqueue(m, sub);
+                for(auto &sub: *patternSubs) sub->enqueue(m, sub);
+            }
+            for(auto &sub: *subs) Subscriber::schedule(sub);
+            for(auto &sub: *patternSubs) Subscriber::schedule(sub);
+            batch.clear();
+            fanningOut = false;
+        }
+    }
 };
 
-int main() {
-    Topic topic("main topic");
 
-    topic.addSub("subscriber 1", [](const Message &msg) -> void {
-        cout << "Subscriber 1 " <<msg.id << " " << msg.message << endl;
-    });
+// Subscription trie over dot separated topic levels. `*` matches exactly one level, `#` (last level only) matches
+// zero or more. Nodes are immutable once published, inserting or erasing a pattern copies only the path from
+// the root to the changed node, so readers can keep matching against the old root.
+// Matching walks the trie level by level, its cost depends on the depth of the name, not on the number of patterns.
+template<typename T>
+struct PatternTrie {
+    struct Node {
+        map<string, shared_ptr<const Node>, less<>> children;
+        optional<T> value;
+    };
+    using Root = shared_ptr<const Node>;
+
+    static vector<string_view> split(string_view name) {
+        vector<string_view> levels;
+        size_t start = 0;
+        while(true) {
+            size_t dot = name.find('.', start);
+            levels.push_back(name.substr(start, dot == string_view::npos ? string_view::npos : dot - start));
+            if (dot == string_view::npos) return levels;
+            start = dot + 1;
+        }
+    }
+
+    static bool validPattern(const vector<string_view> &levels) {
+        for(size_t i = 0; i < levels.size(); i++) {
+            if (levels[i].empty()) return false;
+            if (levels[i] == "#" and i + 1 != levels.size()) return false;
+        }
+        return true;
+    }
+
+    static const Node *child(const Node *node, string_view level) {
+        if (!node) return nullptr;
+        auto it = node->children.find(level);
+        return it == node->children.end() ? nullptr : it->second.get();
+    }
+
+    static const T *find(const Node *node, const vector<string_view> &levels) {
+        for(auto level: levels) {
+            node = child(node, level);
+            if (!node) return nullptr;
+        }
+        return node->value ? &*node->value : nullptr;
+    }
 
-    topic.addSub("subscriber 2", [](const Message &msg) -> void {
-        cout << "Subscriber 2 " <<msg.id << " " << msg.message << endl;
+    // Returns the new root with the pattern set to value, or removed when value is empty.
+    static Root with(const Node *node, const vector<string_view> &levels, optional<T> value, size_t i = 0) {
+        auto copy = node ? make_shared<Node>(*node) : make_shared<Node>();
+        if (i == levels.size()) {
+            copy->value = std::move(value);
+        } else if (auto next = with(child(node, levels[i]), levels, std::move(value), i + 1)) {
+            copy->children[string(levels[i])] = std::move(next);
+        } else if (auto it = copy->children.find(levels[i]); it != copy->children.end()) {
+            copy->children.erase(it);
+        }
+        // Prune nodes left without a value or children, except the root.
+        if (i > 0 and !copy->value and copy->children.empty()) return nullptr;
+        return copy;
+    }
+
+    static void match(const Node *node, const vector<string_view> &levels, vector<T> &out, size_t i = 0) {
+        if (!node) return;
+        if (auto rest = child(node, "#"); rest and rest->value) out.push_back(*rest->value);
+        if (i == levels.size()) {
+            if (node->value) out.push_back(*node->value);
+            return;
+        }
+        match(child(node, levels[i]), levels, out, i + 1);
+        match(child(node, "*"), levels, out, i + 1);
+    }
+
+    static void forEach(const Node *node, const function<void(const T&)> &fn) {
+        if (!node) return;
+        if (node->value) fn(*node->value);
+        for(auto &[level, next]: node->children) forEach(next.get(), fn);
+    }
+};
+
+
+// Topic registry, also copy on write so looking up a topic to publish never waits on topic creation or removal.
+// Every distinct subscription pattern keeps its subscribers in a PatternTrie. Each topic holds the subscribers of the
+// patterns matching its name and its fan-out thread delivers to them directly, so they see the topic's own sequence
+// numbers. A name without a topic needs no thread of its own: the publisher looks up the matching pattern
+// subscribers in a direct mapped route cache, invalidated whenever the set of patterns changes, and enqueues to them.
+class Broker {
+    using TopicMap = unordered_map<string, shared_ptr<Topic>>;
+    using Patterns = PatternTrie<shared_ptr<const SubscriberSet>>;
+
+    struct Route {
+        string name;
+        uint64_t version;
+        shared_ptr<const string> topicName;
+        SubscriberSet subscribers;
+    };
+
+    static constexpr size_t ROUTE_CACHE_SLOTS = 4096;
+
+    Dispatcher &dispatcher;
+    mutex writersMutex;
+    atomic<shared_ptr<const TopicMap>> topics;
+    atomic<Patterns::Root> patterns;
+    atomic<uint64_t> patternsVersion;
+    array<atomic<shared_ptr<const Route>>, ROUTE_CACHE_SLOTS> routeCache;
+
+    shared_ptr<const SubscriberSet> matching(const string &topicName) const {
+        vector<shared_ptr<const SubscriberSet>> sets;
+        Patterns::match(patterns.load().get(), Patterns::split(topicName), sets);
+        auto subs = make_shared<SubscriberSet>();
+        for(auto &set: sets) subs->insert(subs->end(), set->begin(), set->end());
+        return subs;
+    }
+
+    // Called with writersMutex held after the patterns changed.
+    void patternsChanged(const Patterns::Root &root) {
+        patterns.store(root);
+        patternsVersion++;
+        for(auto &[name, t]: *topics.load()) t->setPatternSubscribers(matching(name));
+    }
+
+    public:
+    atomic<size_t> routeHits;
+    atomic<size_t> routeMisses;
+
+    explicit Broker(Dispatcher &dispatcher):dispatcher(dispatcher), patternsVersion(0), routeHits(0), routeMisses(0) {
+        topics.store(make_shared<const TopicMap>());
+        patterns.store(make_shared<const Patterns::Node>());
+    }
+
+    shared_ptr<Topic> createTopic(const string &name) {
+        lock_guard<mutex> lock(writersMutex);
+        auto current = topics.load();
+        auto it = current->find(name);
+        if (it != current->end()) return it->second;
+        auto next = make_shared<TopicMap>(*current);
+        auto topic = make_shared<Topic>(name, dispatcher);
+        topic->setPatternSubscribers(matching(name));
+        (*next)[name] = topic;
+        topics.store(std::move(next));
+        return topic;
+    }
+
+    bool removeTopic(const string &name) {
+        lock_guard<mutex> lock(writersMutex);
+        auto current = topics.load();
+        if (current->find(name) == current->end()) return false;
+        auto next = make_shared<TopicMap>(*current);
+        next->erase(name);
+        topics.store(std::move(next));
+        return true;
+    }
+
+    shared_ptr<Topic> topic(const string &name) const {
+        auto current = topics.load();
+        auto it = current->find(name);
+        return it == current->end() ? nullptr : it->second;
+    }
+
+    // Pattern subscribers whose pattern matches topicName, served from the route cache when possible.
+    shared_ptr<const Route> route(string_view topicName) {
+        uint64_t version = patternsVersion.load();
+        auto &slot = routeCache[hash<string_view>{}(topicName) & (ROUTE_CACHE_SLOTS - 1)];
+        auto cached = slot.load();
+        if (cached and cached->version == version and cached->name == topicName) {
+            routeHits.fetch_add(1, memory_order_relaxed);
+            return cached;
+        }
+        routeMisses.fetch_add(1, memory_order_relaxed);
+        auto computed = make_shared<Route>();
+        computed->name = topicName;
+        computed->version = version;
+        computed->topicName = make_shared<const string>(topicName);
+        computed->subscribers = *matching(computed->name);
+        slot.store(computed);
+        return computed;
+    }
+
+    bool publish(const string &topicName, const Message &msg) {
+        return publishBatch(topicName, span<const Message>(&msg, 1));
+    }
+
+    bool publishBatch(const string &topicName, span<const Message> msgs) {
+        auto r = route(topicName);
+        auto t = topic(topicName);
+        if (!t and r->subscribers.empty()) return false;
+        vector<Message> routed(msgs.begin(), msgs.end());
+        auto now = chrono::steady_clock::now();
+        for(auto &msg: routed) {
+            msg.topic = r->topicName;
+            msg.publishedAt = now;
+        }
+        if (t) {
+            t->publishBatch(routed);
+            return true;
+        }
+        for(auto &sub: r->subscribers) {
+            sub->enqueueDirect(routed, sub);
+            Subscriber::schedule(sub);
+        }
+        return true;
+    }
+
+    bool subscribePattern(const string &pattern, const string &subscriber, Callback callback, OverflowPolicy policy = OverflowPolicy::DROP) {
+        auto levels = Patterns::split(pattern);
+        if (!Patterns::validPattern(levels)) return false;
+        lock_guard<mutex> lock(writersMutex);
+        auto root = patterns.load();
+        auto found = Patterns::find(root.get(), levels);
+        auto next = found ? make_shared<SubscriberSet>(**found) : make_shared<SubscriberSet>();
+        for(auto &sub: *next) {
+            if (sub->name == subscriber) return true;
+        }
+        auto sub = make_shared<Subscriber>(subscriber, std::move(callback), policy, &dispatcher, 256);
+        sub->sharedProducers = true;
+        next->push_back(std::move(sub));
+        patternsChanged(Patterns::with(root.get(), levels, shared_ptr<const SubscriberSet>(std::move(next))));
+        return true;
+    }
+
+    // Like Topic::removeSub, no callback of the subscriber is running or starts once it returns.
+    bool unsubscribePattern(const string &pattern, const string &subscriber) {
+        auto levels = Patterns::split(pattern);
+        shared_ptr<Subscriber> sub;
+        {
+            lock_guard<mutex> lock(writersMutex);
+            auto root = patterns.load();
+            auto found = Patterns::find(root.get(), levels);
+            if (!found) return false;
+            auto next = make_shared<SubscriberSet>(**found);
+            auto it = find_if(next->begin(), next->end(), [&](auto &s) -> bool { return s->name == subscriber; });
+            if (it == next->end()) return true;
+            sub = *it;
+            next->erase(it);
+            optional<shared_ptr<const SubscriberSet>> value;
+            if (!next->empty()) value = std::move(next);
+            patternsChanged(Patterns::with(root.get(), levels, std::move(value)));
+        }
+        sub->deactivate();
+        return true;
+    }
+
+    void flush() {
+        for(auto &[name, t]: *topics.load()) t->flush();
+        Patterns::forEach(patterns.load().get(), [](const shared_ptr<const SubscriberSet> &subs) -> void {
+            for(auto &sub: *subs) {
+                while(!sub->idle()) this_thread::yield();
+            }
+        });
+    }
+
+    bool subscribe(const string &topicName, const string &subscriber, Callback callback, OverflowPolicy policy = OverflowPolicy::DROP) {
+        auto t = topic(topicName);
+        if (!t) return false;
+        t->addSub(subscriber, std::move(callback), policy);
+        return true;
+    }
+
+    bool unsubscribe(const string &topicName, const string &subscriber) {
+        auto t = topic(topicName);
+        if (!t) return false;
+        t->removeSub(subscriber);
+        return true;
+    }
+};
+
+
+struct LatencyStats {
+    vector<double> samples;
+    void add(double us) { samples.push_back(us); }
+    double percentile(double p) {
+        if (samples.empty()) return 0;
+        sort(samples.begin(), samples.end());
+        return samples[min(samples.size() - 1, (size_t)(p * samples.size()))];
+    }
+};
+
+
+// Publish latency against the old synchronous loop, as the subscriber count grows.
+void benchmarkPublishLatency(Dispatcher &dispatcher) {
+    constexpr int MESSAGES = 2000;
+    cout << "\nPublish latency (us)" << endl;
+    for(int subscriberCount: {1, 100, 10000}) {
+        atomic<size_t> received(0);
+        vector<Callback> callbacks;
+        Topic topic("bench", dispatcher);
+        for(int i = 0; i < subscriberCount; i++) {
+            Callback cb = [&received](const Message &) -> void { received++; };
+            callbacks.push_back(cb);
+            topic.addSub("s" + to_string(i), cb, OverflowPolicy::BLOCK, 64);
+        }
+
+        LatencyStats sync, async;
+        Message msg("payload");
+        for(int i = 0; i < MESSAGES; i++) {
+            auto start = chrono::steady_clock::now();
+            for(auto &cb: callbacks) cb(msg);
+            sync.add(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        received = 0;
+        auto begin = chrono::steady_clock::now();
+        for(int i = 0; i < MESSAGES; i++) {
+            auto start = chrono::steady_clock::now();
+            topic.publish(msg);
+            async.add(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        topic.flush();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        cout << subscriberCount << " subscribers: sync p50 " << sync.percentile(0.5) << " p99 " << sync.percentile(0.99)
+             << ", async p50 " << async.percentile(0.5) << " p99 " << async.percentile(0.99)
+             << ", " << (size_t)(received / seconds) << " deliveries/s" << endl;
+    }
+}
+
+
+// One slow subscriber next to a fast one, per overflow policy.
+void benchmarkDeliveryLatency(Dispatcher &dispatcher) {
+    constexpr int MESSAGES = 5000;
+    cout << "\nEnd to end latency with a slow subscriber (us)" << endl;
+    for(auto [policy, label]: {pair{OverflowPolicy::DROP, "drop"}, pair{OverflowPolicy::BLOCK, "block"}, pair{OverflowPolicy::CONFLATE, "conflate"}}) {
+        mutex m;
+        LatencyStats fast, publishing;
+        size_t slowReceived = 0;
+        {
+            Topic topic("bench", dispatcher);
+            topic.addSub("fast", [&](const Message &msg) -> void {
+                auto us = chrono::duration<double, micro>(chrono::steady_clock::now() - msg.publishedAt).count();
+                lock_guard<mutex> lock(m);
+                fast.add(us);
+            }, policy, 1024);
+            topic.addSub("slow", [&](const Message &) -> void {
+                this_thread::sleep_for(chrono::microseconds(50));
+                lock_guard<mutex> lock(m);
+                slowReceived++;
+            }, policy, 128);
+
+            Message msg("payload");
+            for(int i = 0; i < MESSAGES; i++) {
+                auto start = chrono::steady_clock::now();
+                topic.publish(msg);
+                publishing.add(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+            topic.flush();
+            cout << label << ": publish p99 " << publishing.percentile(0.99)
+                 << ", fast subscriber p50 " << fast.percentile(0.5) << " p99 " << fast.percentile(0.99)
+                 << ", slow subscriber got " << slowReceived << "/" << MESSAGES
+                 << " (dropped " << topic.dropped("slow") << ")" << endl;
+        }
+    }
+}
+
+
+// Publishers on a broker with and without threads constantly subscribing, unsubscribing and creating topics.
+void benchmarkChurn(Dispatcher &dispatcher) {
+    constexpr int TOPICS = 16;
+    constexpr int SUBSCRIBERS = 50;
+    constexpr int PUBLISHERS = 2;
+    constexpr int MESSAGES_PER_PUBLISHER = 50000;
+    cout << "\nPublishing under subscription churn" << endl;
+    for(int churners: {0, 2}) {
+        Broker broker(dispatcher);
+        atomic<size_t> received(0);
+        auto cb = [&received](const Message &) -> void { received++; };
+        for(int t = 0; t < TOPICS; t++) {
+            broker.createTopic("topic" + to_string(t));
+            for(int i = 0; i < SUBSCRIBERS; i++) broker.subscribe("topic" + to_string(t), "s" + to_string(i), cb);
+        }
+
+        atomic<bool> done(false);
+        atomic<size_t> churnOps(0);
+        vector<thread> churn;
+        for(int c = 0; c < churners; c++) {
+            churn.emplace_back([&, c]() -> void {
+                int i = 0;
+                while(!done) {
+                    string topic = "topic" + to_string(i % TOPICS), name = "churn" + to_string(c) + "_" + to_string(i);
+                    broker.subscribe(topic, name, cb);
+                    broker.unsubscribe(topic, name);
+                    broker.createTopic("temp" + to_string(c));
+                    broker.removeTopic("temp" + to_string(c));
+                    churnOps += 4;
+                    i++;
+                }
+            });
+        }
+
+        vector<LatencyStats> latencies(PUBLISHERS);
+        vector<thread> publishers;
+        auto begin = chrono::steady_clock::now();
+        for(int p = 0; p < PUBLISHERS; p++) {
+            publishers.emplace_back([&, p]() -> void {
+                Message msg("payload");
+                for(int i = 0; i < MESSAGES_PER_PUBLISHER; i++) {
+                    auto start = chrono::steady_clock::now();
+                    broker.publish("topic" + to_string(i % TOPICS), msg);
+                    latencies[p].add(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+                }
+            });
+        }
+        for(auto &t: publishers) t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        done = true;
+        for(auto &t: churn) t.join();
+
+        LatencyStats all;
+        for(auto &l: latencies) all.samples.insert(all.samples.end(), l.samples.begin(), l.samples.end());
+        cout << churners << " churn threads: " << (size_t)(PUBLISHERS * MESSAGES_PER_PUBLISHER / seconds) << " publishes/s"
+             << ", p50 " << all.percentile(0.5) << " us p99 " << all.percentile(0.99) << " us"
+             << ", " << churnOps << " subscription changes" << endl;
+        for(int t = 0; t < TOPICS; t++) broker.topic("topic" + to_string(t))->flush();
+    }
+}
+
+
+// Fan-out cost per payload size: copying the bytes for every subscriber (the old std::string message)
+// against sharing one refcounted buffer through the topic.
+void benchmarkPayloadSharing(Dispatcher &dispatcher) {
+    constexpr int SUBSCRIBERS = 32;
+    constexpr int MESSAGES = 2000;
+    cout << "\nPayload sharing, " << SUBSCRIBERS << " subscribers" << endl;
+    for(size_t size: {64, 4096, 65536}) {
+        string body(size, 'x');
+
+        atomic<size_t> outOfOrder(0);
+        // Deliveries per second through a topic, with every subscriber taking its own std::string copy of the bytes
+        // as a string message would give it, or reading the shared buffer.
+        auto run = [&](bool copyBytes) -> double {
+            atomic<size_t> received(0), copiedBytes(0);
+            chrono::steady_clock::time_point begin;
+            {
+                Topic topic("bench", dispatcher);
+                for(int i = 0; i < SUBSCRIBERS; i++) {
+                    auto last = make_shared<uint64_t>(0);
+                    topic.addSub("s" + to_string(i), [&, last, copyBytes](const Message &msg) -> void {
+                        if (copyBytes) {
+                            string copy(msg.text());
+                            copiedBytes.fetch_add(copy.size(), memory_order_relaxed);
+                        }
+                        if (msg.sequence != *last + 1) outOfOrder++;
+                        *last = msg.sequence;
+                        received++;
+                    }, OverflowPolicy::BLOCK, 256);
+                }
+                begin = chrono::steady_clock::now();
+                for(int i = 0; i < MESSAGES; i++) {
+                    // A small header and the body in one buffer.
+                    topic.publish(Message(Payload::gather({"header:", body})));
+                }
+                topic.flush();
+            }
+            return received / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        };
+        double copied = run(true);
+        double shared = run(false);
+
+        cout << size << " B: copy per subscriber " << (size_t)copied << " deliveries/s, shared buffer " << (size_t)shared
+             << " deliveries/s, out of order " << outOfOrder << ", slab pool " << SlabPool::global().reservedBytes() / 1024 << " KB" << endl;
+    }
+}
+
+
+// Append throughput of a durable topic per fsync policy, then catch-up reads of the whole log by a new group
+// and a restart that resumes a group from its committed offset.
+void benchmarkDurableLog(Dispatcher &dispatcher) {
+    constexpr int MESSAGES = 100000;
+    const string dir = "TopicLogBench";
+    string body(256, 'x');
+    cout << "\nDurable topic log, " << MESSAGES << " messages of " << body.size() << " B" << endl;
+
+    struct Mode {
+        string label;
+        optional<DurabilityOptions> durability;
+    };
+    DurabilityOptions everyBatch{dir, 16 << 20, 1};
+    DurabilityOptions batched{dir, 16 << 20};
+    for(auto &mode: vector<Mode>{{"in memory", nullopt}, {"fsync every batch", everyBatch}, {"fsync every 4096 msgs / 10ms", batched}}) {
+        filesystem::remove_all(dir);
+        auto topic = mode.durability ? make_unique<Topic>("bench", dispatcher, *mode.durability) : make_unique<Topic>("bench", dispatcher);
+        auto begin = chrono::steady_clock::now();
+        for(int i = 0; i < MESSAGES; i++) topic->publish(Message(body));
+        topic->flush();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        cout << mode.label << ": append " << (size_t)(MESSAGES / seconds) << " msgs/s, "
+             << (size_t)(MESSAGES * body.size() / seconds / (1 << 20)) << " MB/s" << endl;
+    }
+
+    size_t received = 0;
+    {
+        Topic topic("bench", dispatcher, batched);
+        auto begin = chrono::steady_clock::now();
+        size_t replayed = topic.subscribeFrom("subscriber 1", [&](const Message &msg) -> void {
+            received++;
+            if (received == MESSAGES / 2) topic.commit("subscriber 1", msg.sequence);
+        });
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        cout << "catch-up: replayed " << replayed << "/" << received << " msgs, " << (size_t)(replayed / seconds) << " msgs/s" << endl;
+    }
+
+    // Restart: sequence numbering continues and the group resumes right after its committed offset.
+    Topic topic("bench", dispatcher, batched);
+    uint64_t first = 0;
+    size_t replayed = topic.subscribeFrom("subscriber 1", [&](const Message &msg) -> void {
+        if (!first) first = msg.sequence;
     });
-    
-    Message m("This is a new message");
-    topic.publish(m);
+    topic.publish(Message("after restart"));
+    topic.flush();
+    assert(topic.committedOffset("subscriber 1") == MESSAGES / 2 and first == MESSAGES / 2 + 1);
+    cout << "restart: committed " << topic.committedOffset("subscriber 1") << ", resumed at " << first
+         << ", replayed " << replayed << endl;
+}
+
+
+// Naive matcher used as the baseline, one pattern at a time.
+bool patternMatches(const vector<string_view> &pattern, const vector<string_view> &name) {
+    size_t i = 0;
+    for(; i < pattern.size(); i++) {
+        if (pattern[i] == "#") return true;
+        if (i == name.size() or (pattern[i] != "*" and pattern[i] != name[i])) return false;
+    }
+    return i == name.size();
+}
+
+
+// Trie matching against scanning every pattern as the subscription count grows, then the broker route cache.
+void benchmarkPatternMatching(Dispatcher &dispatcher) {
+    constexpr int LOOKUPS = 20000;
+    using Trie = PatternTrie<int>;
+    cout << "\nPattern matching (ns per lookup)" << endl;
+    mt19937 gen(1);
+    for(int count: {100, 1000, 10000}) {
+        // The trie keeps one entry per distinct pattern, so duplicates are skipped for a fair comparison.
+        vector<string> patterns;
+        unordered_set<string> distinct;
+        for(int k = 0; (int)patterns.size() < count; k++) {
+            string app = "app" + to_string(k % 100), svc = "svc" + to_string(k);
+            switch (k % 4) {
+                case 0: patterns.push_back(app + "." + svc + ".*"); break;
+                case 1: patterns.push_back(app + ".*.evt" + to_string(k % 7)); break;
+                case 2: patterns.push_back(app + "." + svc + ".#"); break;
+                case 3: patterns.push_back(app + "." + svc + ".evt" + to_string(k % 7)); break;
+            }
+            if (!distinct.insert(patterns.back()).second) patterns.pop_back();
+        }
+        Trie::Root root = make_shared<Trie::Node>();
+        vector<vector<string_view>> split;
+        for(int k = 0; k < count; k++) {
+            split.push_back(Trie::split(patterns[k]));
+            root = Trie::with(root.get(), split.back(), k);
+        }
+        vector<string> names;
+        for(int i = 0; i < LOOKUPS; i++) {
+            int k = gen() % count;
+            names.push_back("app" + to_string(k % 100) + ".svc" + to_string(k) + ".evt" + to_string(gen() % 7) + (i % 2 ? ".deep.er.still" : ""));
+        }
+
+        size_t trieMatches = 0, scanMatches = 0;
+        vector<int> out;
+        auto begin = chrono::steady_clock::now();
+        for(auto &name: names) {
+            out.clear();
+            Trie::match(root.get(), Trie::split(name), out);
+            trieMatches += out.size();
+        }
+        double trieNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / LOOKUPS;
+        begin = chrono::steady_clock::now();
+        for(auto &name: names) {
+            auto levels = Trie::split(name);
+            for(auto &pattern: split) scanMatches += patternMatches(pattern, levels);
+        }
+        double scanNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / LOOKUPS;
+        cout << count << " patterns: trie " << (size_t)trieNs << ", scan " << (size_t)scanNs
+             << ", matches " << trieMatches << (trieMatches == scanMatches ? "" : " MISMATCH") << endl;
+    }
+
+    Broker broker(dispatcher);
+    for(int k = 0; k < 40; k++) broker.subscribePattern("app" + to_string(k % 10) + ".svc" + to_string(k) + ".*", "s", [](const Message &) -> void {});
+    broker.subscribePattern("app1.#", "audit", [](const Message &) -> void {});
+    vector<string> hot;
+    for(int k = 0; k < 40; k++) hot.push_back("app" + to_string(k % 10) + ".svc" + to_string(k) + ".created");
+    auto begin = chrono::steady_clock::now();
+    size_t routed = 0;
+    for(int i = 0; i < LOOKUPS * 10; i++) routed += broker.route(hot[i % hot.size()])->subscribers.size();
+    double cachedNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / (LOOKUPS * 10);
+    cout << "broker route, " << hot.size() << " hot topics: " << (size_t)cachedNs << " ns, hits " << broker.routeHits << " misses " << broker.routeMisses
+         << ", " << routed << " routed" << endl;
+}
+
+
+// Throughput as publishers hand over batches and subscribers take batches, batch size 1 is the per message path.
+void benchmarkBatching(Dispatcher &dispatcher) {
+    constexpr int MESSAGES = 200000;
+    constexpr int SUBSCRIBERS = 4;
+    cout << "\nBatching, " << SUBSCRIBERS << " subscribers" << endl;
+    for(size_t batchSize: {1, 8, 64, 512}) {
+        atomic<size_t> received(0);
+        double seconds;
+        {
+            Topic topic("bench", dispatcher);
+            for(int i = 0; i < SUBSCRIBERS; i++) {
+                if (batchSize == 1) {
+                    topic.addSub("s" + to_string(i), [&received](const Message &) -> void {
+                        received.fetch_add(1, memory_order_relaxed);
+                    }, OverflowPolicy::BLOCK, 1024);
+                } else {
+                    topic.addBatchSub("s" + to_string(i), [&received](span<const Message> batch) -> void {
+                        received.fetch_add(batch.size(), memory_order_relaxed);
+                    }, {batchSize, chrono::microseconds(500)}, OverflowPolicy::BLOCK, 1024);
+                }
+            }
+            vector<Message> batch(batchSize, Message("payload"));
+            auto begin = chrono::steady_clock::now();
+            for(int sent = 0; sent < MESSAGES; sent += batchSize) {
+                if (batchSize == 1) topic.publish(batch[0]);
+                else topic.publishBatch(batch);
+            }
+            topic.flush();
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        }
+        cout << "batch " << batchSize << ": " << (size_t)(MESSAGES / seconds) << " msgs/s published, "
+             << (size_t)(received / seconds) << " deliveries/s" << endl;
+    }
+}
+
+
+int main() {
+    Dispatcher dispatcher(4);
+    {
+        Topic topic("main topic", dispatcher);
+
+        topic.addSub("subscriber 1", [](const Message &msg) -> void {
+            cout << "Subscriber 1 " <<msg.sequence << " " << msg.text() << endl;
+        });
+
+        topic.addSub("subscriber 2", [](const Message &msg) -> void {
+            cout << "Subscriber 2 " <<msg.sequence << " " << msg.text() << endl;
+        });
+
+        Message m("This is a new message");
+        topic.publish(m);
+
+        Message m2("This is a new message 2");
+        topic.publish(m2);
+        topic.flush();
+    }
+    {
+        Broker broker(dispatcher);
+        broker.subscribePattern("orders.eu.*", "eu orders", [](const Message &msg) -> void {
+            cout << "eu orders " << *msg.topic << " " << msg.text() << endl;
+        });
+        broker.subscribePattern("orders.#", "all orders", [](const Message &msg) -> void {
+            cout << "all orders " << *msg.topic << " " << msg.text() << endl;
+        });
+        broker.publish("orders.eu.fr", Message("order 1"));
+        broker.publish("orders.us", Message("order 2"));
+        broker.publish("payments.eu.fr", Message("payment 1"));
+        broker.flush();
+    }
 
-    Message m2("This is a new message 2");
-    topic.publish(m2);
+    benchmarkPublishLatency(dispatcher);
+    benchmarkDeliveryLatency(dispatcher);
+    benchmarkChurn(dispatcher);
+    benchmarkPayloadSharing(dispatcher);
+    benchmarkDurableLog(dispatcher);
+    benchmarkPatternMatching(dispatcher);
+    benchmarkBatching(dispatcher);
 }
 
 /*
@@ -13,6 +13,16 @@
 #include <future>
 #include <iostream>
 #include <random>
+#include <optional>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <fstream>
+#include <filesystem>
+#include <barrier>
 
 
 
@@ -99,10 +109,17 @@ class Url {
     public:
     string url;
     int depth;
-    Url(const string &url):url(url), depth(0) {}
+    Url(const string &url, int depth = 0):url(url), depth(depth) {}
+    // Identity is the address only, depth is crawl metadata that changes as the url is rediscovered.
     bool operator==(const Url& other) const {
-        return other.depth == depth and other.url == url;
+        return other.url == url;
     };
+    string host() const {
+        size_t start = url.find("://");
+        start = start == string::npos ? 0 : start + 3;
+        size_t end = url.find('/', start);
+        return url.substr(start, end == string::npos ? string::npos : end - start);
+    }
     string data() const {
         this_thread::sleep_for(chrono::milliseconds(100));
         return "Parsed";
@@ -114,26 +131,732 @@ class Url {
 
 struct Hash {
     size_t operator()(const Url& url) const {
-        return hash<string>{}(url.url + to_string(url.depth));
+        return hash<string>{}(url.url);
+    }
+};
+
+
+enum class CrawlPriority {
+    FIFO,
+    DEPTH,
+    INBOUND_LINKS,
+    CUSTOM
+};
+
+
+struct CrawlPolicy {
+    CrawlPriority priority = CrawlPriority::DEPTH;
+    int maxDepth = numeric_limits<int>::max();
+    int perHostBudget = numeric_limits<int>::max();
+    // Only used for CrawlPriority::CUSTOM, higher score is crawled first.
+    function<double(const Url&, int inboundLinks)> score;
+
+    CrawlPolicy(CrawlPriority priority = CrawlPriority::DEPTH, int maxDepth = numeric_limits<int>::max(), int perHostBudget = numeric_limits<int>::max()):
+    priority(priority), maxDepth(maxDepth), perHostBudget(perHostBudget) {}
+};
+
+
+// Scored frontier backed by a binary heap, so push and pop stay O(log n).
+// A url whose score changes (shallower depth, more inbound links) is pushed again with a new version,
+// the old heap entry becomes stale and is skipped on pop.
+class Frontier {
+    struct Entry {
+        double score;
+        uint64_t seq;
+        uint64_t version;
+        Url url;
+    };
+    struct Compare {
+        bool operator()(const Entry &a, const Entry &b) const {
+            if (a.score != b.score) return a.score < b.score;
+            return a.seq > b.seq;
+        }
+    };
+    struct Pending {
+        int depth;
+        double score;
+        uint64_t version;
+    };
+
+    CrawlPolicy policy;
+    priority_queue<Entry, vector<Entry>, Compare> heap;
+    unordered_map<string, Pending> pending;
+    unordered_map<string, int> inbound;
+    unordered_map<string, int> hostDispatched;
+    unordered_set<string> dispatched;
+    uint64_t seq;
+
+    double scoreOf(const Url &url) {
+        switch (policy.priority) {
+            case CrawlPriority::FIFO: return 0;
+            case CrawlPriority::DEPTH: return -url.depth;
+            case CrawlPriority::INBOUND_LINKS: return inbound[url.url];
+            case CrawlPriority::CUSTOM: return policy.score ? policy.score(url, inbound[url.url]) : 0;
+        }
+        return 0;
+    }
+
+    bool hostExhausted(const string &host) {
+        auto it = hostDispatched.find(host);
+        return it != hostDispatched.end() and it->second >= policy.perHostBudget;
+    }
+
+    public:
+    size_t droppedByDepth = 0;
+    size_t droppedByHost = 0;
+
+    explicit Frontier(CrawlPolicy policy = CrawlPolicy()):policy(std::move(policy)), seq(0) {}
+
+    // url.depth must already be set by the caller.
+    void push(const Url &url) {
+        if (dispatched.count(url.url)) return;
+        if (url.depth > policy.maxDepth) {
+            droppedByDepth++;
+            return;
+        }
+        if (hostExhausted(url.host())) {
+            droppedByHost++;
+            return;
+        }
+        auto it = pending.find(url.url);
+        Url queued = url;
+        if (it != pending.end()) {
+            queued.depth = min(url.depth, it->second.depth);
+            double score = scoreOf(queued);
+            if (queued.depth == it->second.depth and score == it->second.score) return;
+            it->second = {queued.depth, score, it->second.version + 1};
+            heap.push({score, seq++, it->second.version, queued});
+            return;
+        }
+        double score = scoreOf(queued);
+        pending[url.url] = {queued.depth, score, 0};
+        heap.push({score, seq++, 0, queued});
+    }
+
+    // Children are one level below the parent and count as inbound links for INBOUND_LINKS / CUSTOM scoring.
+    void addLinks(const Url &parent, const vector<Url> &links) {
+        for(auto &link: links) {
+            inbound[link.url]++;
+            push(Url(link.url, parent.depth + 1));
+        }
+    }
+
+    optional<Url> pop() {
+        while(!heap.empty()) {
+            auto entry = heap.top();
+            heap.pop();
+            auto it = pending.find(entry.url.url);
+            if (it == pending.end() or it->second.version != entry.version) continue;
+            pending.erase(it);
+            string host = entry.url.host();
+            if (hostExhausted(host)) {
+                droppedByHost++;
+                continue;
+            }
+            hostDispatched[host]++;
+            dispatched.insert(entry.url.url);
+            return entry.url;
+        }
+        return nullopt;
+    }
+
+    bool empty() const {
+        return pending.empty();
+    }
+
+    size_t size() const {
+        return pending.size();
+    }
+};
+
+
+// Small LZ77 block codec (LZ4 style, varint framed) so the page store needs no external library.
+// Block layout: repeated [varint literals][literal bytes][varint matchLength][varint offset], matchLength 0 ends the block.
+class BlockCodec {
+    static constexpr int MIN_MATCH = 4;
+    static constexpr int HASH_BITS = 12;
+
+    static void putVarint(string &out, uint32_t v) {
+        while(v >= 0x80) {
+            out.push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((char)v);
+    }
+
+    static bool getVarint(string_view in, size_t &pos, uint32_t &v) {
+        v = 0;
+        for(int shift = 0; shift < 35 and pos < in.size(); shift += 7) {
+            uint8_t b = in[pos++];
+            v |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static uint32_t hash4(const char *p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    public:
+    static string compress(string_view in) {
+        string out;
+        out.reserve(in.size() / 2 + 16);
+        vector<int> table(1 << HASH_BITS, -1);
+        size_t anchor = 0, pos = 0;
+        while(pos + MIN_MATCH <= in.size()) {
+            uint32_t h = hash4(in.data() + pos);
+            int candidate = table[h];
+            table[h] = pos;
+            if (candidate < 0 or memcmp(in.data() + candidate, in.data() + pos, MIN_MATCH) != 0) {
+                pos++;
+                continue;
+            }
+            size_t length = MIN_MATCH;
+            while(pos + length < in.size() and in[candidate + length] == in[pos + length]) length++;
+            putVarint(out, pos - anchor);
+            out.append(in.substr(anchor, pos - anchor));
+            putVarint(out, length);
+            putVarint(out, pos - candidate);
+            pos += length;
+            anchor = pos;
+        }
+        putVarint(out, in.size() - anchor);
+        out.append(in.substr(anchor));
+        putVarint(out, 0);
+        return out;
+    }
+
+    static optional<string> decompress(string_view in, size_t rawLength) {
+        string out;
+        out.reserve(rawLength);
+        size_t pos = 0;
+        while(true) {
+            uint32_t literals, length, offset;
+            if (!getVarint(in, pos, literals) or pos + literals > in.size()) return nullopt;
+            out.append(in.substr(pos, literals));
+            pos += literals;
+            if (!getVarint(in, pos, length)) return nullopt;
+            if (length == 0) break;
+            if (!getVarint(in, pos, offset) or offset == 0 or offset > out.size()) return nullopt;
+            // Byte by byte so overlapping matches (offset < length) repeat correctly.
+            size_t from = out.size() - offset;
+            for(size_t i = 0; i < length; i++) out.push_back(out[from + i]);
+        }
+        if (out.size() != rawLength) return nullopt;
+        return out;
+    }
+};
+
+
+struct ChunkId {
+    uint64_t high, low;
+    bool operator==(const ChunkId &other) const {
+        return high == other.high and low == other.low;
+    }
+};
+
+
+struct ChunkIdHash {
+    size_t operator()(const ChunkId &id) const {
+        return id.low ^ (id.high * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+
+struct PageStoreStats {
+    size_t pages = 0;
+    size_t duplicatePages = 0;
+    size_t chunks = 0;
+    size_t uniqueChunks = 0;
+    size_t rawBytes = 0;
+    size_t uniqueBytes = 0;
+    size_t storedBytes = 0;
+    size_t segments = 0;
+
+    double dedupRatio() const { return uniqueBytes ? (double)rawBytes / uniqueBytes : 1; }
+    double compressionRatio() const { return storedBytes ? (double)uniqueBytes / storedBytes : 1; }
+    double storageRatio() const { return storedBytes ? (double)rawBytes / storedBytes : 1; }
+};
+
+
+// Content addressed page store.
+// Pages are split with content defined chunking (gear rolling hash) so shared boilerplate dedups even when it shifts,
+// every unique chunk is compressed with BlockCodec and appended to the active segment file.
+// The chunk index (id -> segment, offset) and the page manifests (url -> chunk ids) live in memory,
+// a store is not reopened across runs so it writes its segments to a fresh subdirectory of the directory it is given
+// and removes that subdirectory when destroyed. Nothing else in the directory is touched.
+// Not thread safe, callers serialize access.
+class PageStore {
+    static constexpr size_t MIN_CHUNK = 512;
+    static constexpr size_t MAX_CHUNK = 16 * 1024;
+    // 12 high bits, cuts on average every 4KB once past MIN_CHUNK.
+    static constexpr uint64_t CUT_MASK = 0xfff0000000000000ULL;
+    static constexpr uint8_t CODEC_RAW = 0;
+    static constexpr uint8_t CODEC_LZ = 1;
+
+    struct Location {
+        uint32_t segment;
+        uint64_t offset;
+        uint32_t rawLength;
+        uint32_t storedLength;
+        uint8_t codec;
+    };
+
+    filesystem::path dir;
+    size_t segmentBytes;
+    uint32_t activeSegment;
+    uint64_t activeSize;
+    ofstream active;
+    ifstream reader;
+    uint32_t readerSegment;
+    unordered_map<ChunkId, Location, ChunkIdHash> chunkIndex;
+    unordered_map<string, vector<ChunkId>> pages;
+    unordered_map<ChunkId, int, ChunkIdHash> pageContents;
+    PageStoreStats stats;
+
+    static const array<uint64_t, 256> &gear() {
+        static const array<uint64_t, 256> table = []() {
+            array<uint64_t, 256> t;
+            mt19937_64 gen(0x5eed);
+            for(auto &v: t) v = gen();
+            return t;
+        }();
+        return table;
+    }
+
+    // 128 bit FNV-1a, the prime is 2^88 + 0x13b so the multiply is a shift and a small product.
+    // Not collision resistant against crafted input, appendChunk compares bytes before it dedups.
+    static ChunkId fingerprint(string_view data) {
+        unsigned __int128 h = ((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+        for(unsigned char c: data) {
+            h ^= c;
+            h = (h << 88) + h * 0x13b;
+        }
+        return {(uint64_t)(h >> 64), (uint64_t)h};
+    }
+
+    vector<string_view> split(string_view data) const {
+        vector<string_view> chunks;
+        auto &table = gear();
+        size_t start = 0;
+        uint64_t h = 0;
+        for(size_t i = 0; i < data.size(); i++) {
+            h = (h << 1) + table[(unsigned char)data[i]];
+            size_t length = i + 1 - start;
+            if ((length >= MIN_CHUNK and (h & CUT_MASK) == 0) or length >= MAX_CHUNK) {
+                chunks.push_back(data.substr(start, length));
+                start = i + 1;
+                h = 0;
+            }
+        }
+        if (start < data.size()) chunks.push_back(data.substr(start));
+        return chunks;
+    }
+
+    filesystem::path segmentPath(uint32_t segment) const {
+        return dir / ("segment-" + to_string(segment) + ".seg");
+    }
+
+    void rollSegment() {
+        if (active.is_open()) active.close();
+        activeSegment = stats.segments++;
+        activeSize = 0;
+        active.open(segmentPath(activeSegment), ios::binary | ios::app);
+    }
+
+    optional<ChunkId> appendChunk(string_view chunk) {
+        ChunkId id = fingerprint(chunk);
+        stats.chunks++;
+        // A different chunk under the same fingerprint moves on to the next id.
+        while(chunkIndex.count(id)) {
+            auto stored = readChunk(id);
+            if (!stored) return nullopt;
+            if (*stored == chunk) return id;
+            id.low++;
+        }
+
+        string compressed = BlockCodec::compress(chunk);
+        uint8_t codec = CODEC_LZ;
+        string_view payload = compressed;
+        if (compressed.size() >= chunk.size()) {
+            codec = CODEC_RAW;
+            payload = chunk;
+        }
+        if (activeSize >= segmentBytes) rollSegment();
+
+        // Record: [u32 rawLength][u32 storedLength][u8 codec][payload]
+        uint32_t rawLength = chunk.size(), storedLength = payload.size();
+        active.write((const char*)&rawLength, sizeof(rawLength));
+        active.write((const char*)&storedLength, sizeof(storedLength));
+        active.write((const char*)&codec, sizeof(codec));
+        uint64_t offset = activeSize + sizeof(rawLength) + sizeof(storedLength) + sizeof(codec);
+        active.write(payload.data(), payload.size());
+        if (!active) {
+            // The segment may hold a partial record, the next chunk starts a new one.
+            activeSize = segmentBytes;
+            active.clear();
+            return nullopt;
+        }
+        activeSize = offset + payload.size();
+
+        chunkIndex[id] = {activeSegment, offset, rawLength, storedLength, codec};
+        stats.uniqueChunks++;
+        stats.uniqueBytes += chunk.size();
+        stats.storedBytes += payload.size();
+        return id;
+    }
+
+    optional<string> readChunk(const ChunkId &id) {
+        auto it = chunkIndex.find(id);
+        if (it == chunkIndex.end()) return nullopt;
+        auto &location = it->second;
+        if (location.segment == activeSegment) active.flush();
+        if (readerSegment != location.segment or !reader.is_open()) {
+            reader.close();
+            reader.open(segmentPath(location.segment), ios::binary);
+            readerSegment = location.segment;
+        }
+        reader.clear();
+        reader.seekg(location.offset);
+        string payload(location.storedLength, '\0');
+        if (!reader.read(payload.data(), payload.size())) return nullopt;
+        if (location.codec == CODEC_RAW) return payload;
+        return BlockCodec::decompress(payload, location.rawLength);
+    }
+
+    public:
+    explicit PageStore(const string &parent = "CrawlStore", size_t segmentBytes = 64 << 20):segmentBytes(segmentBytes), activeSegment(0), activeSize(0), readerSegment(numeric_limits<uint32_t>::max()) {
+        filesystem::create_directories(parent);
+        // create_directory fails on an existing name, so the store never shares a directory with other data.
+        for(int n = 0; ; n++) {
+            dir = filesystem::path(parent) / ("store-" + to_string(n));
+            if (filesystem::create_directory(dir)) break;
+        }
+        rollSegment();
+    }
+
+    ~PageStore() {
+        active.close();
+        reader.close();
+        error_code ignored;
+        filesystem::remove_all(dir, ignored);
+    }
+
+    PageStore(const PageStore&) = delete;
+    PageStore &operator=(const PageStore&) = delete;
+
+    // Returns false if a segment write failed, the page is not stored and an earlier version of it is kept.
+    bool put(const string &url, string_view content) {
+        vector<ChunkId> manifest;
+        for(auto chunk: split(content)) {
+            auto id = appendChunk(chunk);
+            if (!id) return false;
+            manifest.push_back(*id);
+        }
+        ChunkId whole = fingerprint(content);
+        if (pageContents[whole]++ > 0) stats.duplicatePages++;
+        if (!pages.count(url)) stats.pages++;
+        stats.rawBytes += content.size();
+        pages[url] = std::move(manifest);
+        return true;
+    }
+
+    optional<string> get(const string &url) {
+        auto it = pages.find(url);
+        if (it == pages.end()) return nullopt;
+        string content;
+        for(auto &id: it->second) {
+            auto chunk = readChunk(id);
+            if (!chunk) return nullopt;
+            content += *chunk;
+        }
+        return content;
+    }
+
+    bool contains(const string &url) const {
+        return pages.count(url) > 0;
+    }
+
+    size_t size() const {
+        return pages.size();
+    }
+
+    const PageStoreStats &statistics() const {
+        return stats;
+    }
+};
+
+
+// Dense integer ids for urls, each url string is stored once.
+class UrlInterner {
+    unordered_map<string, uint32_t> ids;
+    vector<string> names;
+    public:
+    uint32_t intern(const string &url) {
+        auto [it, inserted] = ids.try_emplace(url, names.size());
+        if (inserted) names.push_back(url);
+        return it->second;
+    }
+
+    optional<uint32_t> find(const string &url) const {
+        auto it = ids.find(url);
+        if (it == ids.end()) return nullopt;
+        return it->second;
+    }
+
+    const string &name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+};
+
+
+// Link graph in compressed sparse row form, the out links of node v are targets[offsets[v], offsets[v + 1]).
+struct CsrGraph {
+    vector<uint64_t> offsets;
+    vector<uint32_t> targets;
+    vector<string> urls;
+
+    size_t nodes() const { return urls.size(); }
+    size_t edges() const { return targets.size(); }
+
+    size_t memoryBytes() const {
+        size_t bytes = offsets.size() * sizeof(uint64_t) + targets.size() * sizeof(uint32_t);
+        for(auto &url: urls) bytes += sizeof(string) + url.size();
+        return bytes;
+    }
+
+    CsrGraph transpose() const {
+        CsrGraph t;
+        t.urls = urls;
+        t.offsets.assign(nodes() + 1, 0);
+        t.targets.resize(edges());
+        for(auto target: targets) t.offsets[target + 1]++;
+        for(size_t v = 0; v < nodes(); v++) t.offsets[v + 1] += t.offsets[v];
+        vector<uint64_t> cursor(t.offsets.begin(), t.offsets.end() - 1);
+        for(uint32_t v = 0; v < nodes(); v++) {
+            for(auto e = offsets[v]; e < offsets[v + 1]; e++) t.targets[cursor[targets[e]]++] = v;
+        }
+        return t;
+    }
+
+    // File layout: "CSR1" [varint nodes] [varint edges] then per node [varint length][url bytes],
+    // then per node [varint degree] followed by its sorted targets as varint deltas.
+    // load rejects truncated files and targets outside the node range, so transpose and pageRank can index with them.
+    bool save(const string &path) const {
+        string out = "CSR1";
+        auto put = [&out](uint64_t v) {
+            while(v >= 0x80) {
+                out.push_back((char)(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back((char)v);
+        };
+        put(nodes());
+        put(edges());
+        for(auto &url: urls) {
+            put(url.size());
+            out += url;
+        }
+        for(size_t v = 0; v < nodes(); v++) {
+            put(offsets[v + 1] - offsets[v]);
+            uint32_t previous = 0;
+            for(auto e = offsets[v]; e < offsets[v + 1]; e++) {
+                put(targets[e] - previous);
+                previous = targets[e];
+            }
+        }
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write(out.data(), out.size());
+        return (bool)file;
+    }
+
+    static optional<CsrGraph> load(const string &path) {
+        ifstream file(path, ios::binary);
+        string in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        if (in.compare(0, 4, "CSR1") != 0) return nullopt;
+        size_t pos = 4;
+        bool ok = true;
+        auto get = [&]() -> uint64_t {
+            uint64_t v = 0;
+            for(int shift = 0; shift < 64; shift += 7) {
+                if (pos >= in.size()) break;
+                uint8_t b = in[pos++];
+                v |= (uint64_t)(b & 0x7f) << shift;
+                if (!(b & 0x80)) return v;
+            }
+            ok = false;
+            return 0;
+        };
+        CsrGraph g;
+        uint64_t nodeCount = get(), edgeCount = get();
+        // Every node and edge takes at least one byte, larger counts can only come from a corrupt header.
+        if (!ok or nodeCount > in.size() or edgeCount > in.size()) return nullopt;
+        for(uint64_t v = 0; ok and v < nodeCount; v++) {
+            uint64_t length = get();
+            if (pos + length > in.size()) return nullopt;
+            g.urls.push_back(in.substr(pos, length));
+            pos += length;
+        }
+        g.offsets.push_back(0);
+        for(uint64_t v = 0; ok and v < nodeCount; v++) {
+            uint64_t degree = get();
+            if (degree > edgeCount - g.targets.size()) return nullopt;
+            uint64_t previous = 0;
+            for(uint64_t e = 0; ok and e < degree; e++) {
+                previous += get();
+                if (previous >= nodeCount) return nullopt;
+                g.targets.push_back(previous);
+            }
+            g.offsets.push_back(g.targets.size());
+        }
+        if (!ok or g.edges() != edgeCount or pos != in.size()) return nullopt;
+        return g;
     }
 };
 
 
+// Crawled link graph built incrementally: pages add their out links as one contiguous run as they are crawled,
+// in crawl order. toCsr() reorders runs by node id with a counting pass, nodes never crawled get no out links.
+class CrawlGraph {
+    UrlInterner interner;
+    vector<uint32_t> runNode;
+    vector<uint64_t> runStart;
+    vector<uint32_t> runTargets;
+    public:
+    void addPage(const Url &page, const vector<Url> &links) {
+        runNode.push_back(interner.intern(page.url));
+        runStart.push_back(runTargets.size());
+        for(auto &link: links) runTargets.push_back(interner.intern(link.url));
+    }
+
+    const UrlInterner &ids() const {
+        return interner;
+    }
+
+    size_t edges() const {
+        return runTargets.size();
+    }
+
+    CsrGraph toCsr() const {
+        CsrGraph g;
+        size_t n = interner.size();
+        for(uint32_t v = 0; v < n; v++) g.urls.push_back(interner.name(v));
+        vector<int64_t> runOf(n, -1);
+        for(size_t r = 0; r < runNode.size(); r++) runOf[runNode[r]] = r;
+        g.offsets.assign(n + 1, 0);
+        for(uint32_t v = 0; v < n; v++) {
+            uint64_t degree = 0;
+            if (runOf[v] >= 0) {
+                size_t r = runOf[v];
+                degree = (r + 1 < runStart.size() ? runStart[r + 1] : runTargets.size()) - runStart[r];
+            }
+            g.offsets[v + 1] = g.offsets[v] + degree;
+        }
+        g.targets.resize(g.offsets[n]);
+        for(uint32_t v = 0; v < n; v++) {
+            if (runOf[v] < 0) continue;
+            size_t r = runOf[v];
+            auto begin = runTargets.begin() + runStart[r];
+            auto end = r + 1 < runStart.size() ? runTargets.begin() + runStart[r + 1] : runTargets.end();
+            copy(begin, end, g.targets.begin() + g.offsets[v]);
+            sort(g.targets.begin() + g.offsets[v], g.targets.begin() + g.offsets[v + 1]);
+        }
+        return g;
+    }
+};
+
+
+// Pull based PageRank, each thread owns a range of nodes and reads the previous iteration only, so no atomics.
+// Rank of dangling nodes is spread evenly over all nodes. The workers are started once and meet at a barrier before
+// and after every iteration, the calling thread works the first range.
+vector<double> pageRank(const CsrGraph &g, int threads = thread::hardware_concurrency(), double damping = 0.85, int maxIterations = 50, double tolerance = 1e-9) {
+    size_t n = g.nodes();
+    if (n == 0) return {};
+    threads = max(1, threads);
+    CsrGraph incoming = g.transpose();
+    vector<double> rank(n, 1.0 / n), next(n), contribution(n);
+    vector<double> partialDelta(threads);
+
+    double base = 0;
+    bool done = false;
+    size_t step = (n + threads - 1) / threads;
+    auto work = [&](int t) {
+        size_t begin = min(n, t * step), end = min(n, begin + step);
+        double delta = 0;
+        for(size_t v = begin; v < end; v++) {
+            double sum = 0;
+            for(auto e = incoming.offsets[v]; e < incoming.offsets[v + 1]; e++) sum += contribution[incoming.targets[e]];
+            next[v] = base + damping * sum;
+            delta += fabs(next[v] - rank[v]);
+        }
+        partialDelta[t] = delta;
+    };
+    barrier sync(threads);
+    vector<thread> workers;
+    for(int t = 1; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            while(1) {
+                sync.arrive_and_wait();
+                if (done) return;
+                work(t);
+                sync.arrive_and_wait();
+            }
+        });
+    }
+
+    for(int iteration = 0; iteration < maxIterations; iteration++) {
+        double dangling = 0;
+        for(size_t v = 0; v < n; v++) {
+            auto degree = g.offsets[v + 1] - g.offsets[v];
+            if (degree == 0) dangling += rank[v];
+            contribution[v] = degree ? rank[v] / degree : 0;
+        }
+        base = (1 - damping) / n + damping * dangling / n;
+        sync.arrive_and_wait();
+        work(0);
+        sync.arrive_and_wait();
+        rank.swap(next);
+        double delta = 0;
+        for(auto d: partialDelta) delta += d;
+        if (delta < tolerance) break;
+    }
+    done = true;
+    sync.arrive_and_wait();
+    for(auto &w: workers) w.join();
+    return rank;
+}
+
+
 class WebCrawler {
-    queue<Url> frontier;
+    Frontier frontier;
     unique_ptr<Threadpool> pool;
     bool state;
     int limit;
+    int inFlight;
 
 
     mutex m, m2;
     condition_variable cv;
     vector<Url> urls;
     unordered_map<Url, vector<Url>, Hash> webData;
-    unordered_map<string, string> crawledData;
+    PageStore crawledData;
+    CrawlGraph graph;
     public:
     unordered_set<Url, Hash> visited;
-    WebCrawler(vector<Url> &seeds, unique_ptr<Threadpool> pool, vector<Url> &urls, unordered_map<Url, vector<Url>, Hash> &webData):pool(std::move(pool)),state(true),limit(150),urls(urls), webData(webData) {
+    const PageStore &pages() const {
+        return crawledData;
+    }
+    const CrawlGraph &linkGraph() const {
+        return graph;
+    }
+    WebCrawler(vector<Url> &seeds, unique_ptr<Threadpool> pool, vector<Url> &urls, unordered_map<Url, vector<Url>, Hash> &webData, CrawlPolicy policy = CrawlPolicy()):frontier(std::move(policy)),pool(std::move(pool)),state(true),limit(150),inFlight(0),urls(urls), webData(webData) {
         for(auto &url: seeds) {
             frontier.push(url);
         }
@@ -144,39 +867,42 @@ class WebCrawler {
 
     void crawl() {
         auto task = make_shared<function<void(const Url&)>>([this](const Url &url) -> void {
+            string body = url.data();
             {
                 lock_guard<mutex> lock(m2);
-                cout << this_thread::get_id() << " parsing data " << visited.size() << endl;
+                if (!crawledData.put(url.url, body)) cerr << "failed to store " << url.url << endl;
+            }
+            {
+                lock_guard<mutex> lock(m);
+                cout << this_thread::get_id() << " parsing data " << visited.size() << " depth " << url.depth << endl;
                 visited.insert(url);
-                if (visited.size() == limit) {
+                if ((int)visited.size() >= limit) {
                     state = false;
                 }
-                crawledData[url.url] = url.data();
+                auto &links = webData[url];
+                graph.addPage(url, links);
+                frontier.addLinks(url, links);
+                inFlight--;
             }
             cv.notify_all();
-            {
-                lock_guard<mutex> lock(m2);
-                bool pushed_some = false;
-                for(auto &ch: webData[url])  {
-                    if (visited.find(ch) != visited.end()) continue;
-                    frontier.push(ch);
-                    pushed_some = true;
-                }
-            }
-            cv.notify_one();
         });
         while(1) {
             unique_lock lock(m);
-            cv.wait(lock, [this]() -> bool { return visited.size() >= limit or !frontier.empty();});
+            // Only dispatch what the page limit still allows, so nothing is left running once crawl returns.
+            cv.wait(lock, [this]() -> bool { return inFlight == 0 or (state and !frontier.empty() and (int)visited.size() + inFlight < limit);});
             if (!state) {
-                return;
+                if (inFlight == 0) return;
+                continue;
             }
-            if (!frontier.empty()) {
-                auto url = frontier.front();
-                frontier.pop();
-                lock.unlock();
-                pool->addTask(*task, url);
+            auto url = frontier.pop();
+            if (!url) {
+                // Nothing queued and nothing in flight that could discover more urls.
+                if (inFlight == 0) return;
+                continue;
             }
+            inFlight++;
+            lock.unlock();
+            pool->addTask(*task, *url);
         }
         // Add till the frontier queue is not empty
         // If it is empty then wait for some time and then listen to the queue again,
@@ -188,20 +914,18 @@ class WebCrawler {
 
 
         // Appended Task
-        // 1. Check if the depth is not greater than the required depth
+        // 1. Depth and per host budgets are enforced by the frontier, see CrawlPolicy.
         // 2. Check if throttling required. If required make this sleep for some time before starting crawling again.
     }
 };
 
 
 // Function to generate a random URL
-std::string generateRandomUrl() {
+std::string generateRandomUrl(std::mt19937 &gen) {
     const std::vector<std::string> domains = {".com", ".net", ".org", ".io", ".tech"};
     const std::string chars = "abcdefghijklmnopqrstuvwxyz";
 
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
     std::uniform_int_distribution<> len_dist(5, 10); // Length of website name
     std::uniform_int_distribution<> char_dist(0, chars.size() - 1);
     std::uniform_int_distribution<> domain_dist(0, domains.size() - 1);
@@ -220,24 +944,28 @@ std::string generateRandomUrl() {
 }
 
 
-pair<vector<Url>, unordered_map<Url, vector<Url>, Hash>> createWebData() {
-    constexpr int TOTAL_URLS = 200;
+// seed makes the graph reproducible, pagesPerHost > 1 generates "<site>/page<i>" urls sharing a host,
+// skew > 1 biases link targets towards the front of urls so a few pages collect most inbound links.
+pair<vector<Url>, unordered_map<Url, vector<Url>, Hash>> createWebData(int totalUrls = 200, unsigned seed = std::random_device{}(), int pagesPerHost = 1, double skew = 1.0, bool verbose = true) {
     std::unordered_map<Url, std::vector<Url>, Hash> urlGraph;
     std::vector<Url> urls;
+    std::unordered_set<std::string> generated;
+    std::mt19937 gen(seed);
 
 
     // Generate unique URLs
-    while (urls.size() < TOTAL_URLS) {
-        std::string newUrl = generateRandomUrl();
-        if (std::find(urls.begin(), urls.end(), newUrl) == urls.end()) {
-            urls.push_back(Url(newUrl));
+    while ((int)urls.size() < totalUrls) {
+        std::string newUrl = generateRandomUrl(gen);
+        if (!generated.insert(newUrl).second) continue;
+        urls.push_back(Url(newUrl));
+        for (int page = 1; page < pagesPerHost and (int)urls.size() < totalUrls; ++page) {
+            urls.push_back(Url(newUrl + "/page" + to_string(page)));
         }
     }
 
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
     std::uniform_int_distribution<> link_count_dist(1, 5); // Number of outgoing links
+    std::uniform_real_distribution<> target_dist(0.0, 1.0);
 
 
     int totalLinks = 0;
@@ -249,7 +977,8 @@ pair<vector<Url>, unordered_map<Url, vector<Url>, Hash>> createWebData() {
         std::vector<Url> links;
        
         for (int i = 0; i < linkCount; ++i) {
-            links.push_back(Url(urls[gen() % TOTAL_URLS]));
+            int target = min(totalUrls - 1, (int)(pow(target_dist(gen), skew) * totalUrls));
+            links.push_back(Url(urls[target]));
         }
 
 
@@ -259,10 +988,12 @@ pair<vector<Url>, unordered_map<Url, vector<Url>, Hash>> createWebData() {
 
 
     // Display results
-    for (const auto& [key, value] : urlGraph) {
-        std::cout << key.url << " links to:\n";
-        for (const auto& link : value) {
-            std::cout << "  - " << link.url << "\n";
+    if (verbose) {
+        for (const auto& [key, value] : urlGraph) {
+            std::cout << key.url << " links to:\n";
+            for (const auto& link : value) {
+                std::cout << "  - " << link.url << "\n";
+            }
         }
     }
 
@@ -274,30 +1005,204 @@ pair<vector<Url>, unordered_map<Url, vector<Url>, Hash>> createWebData() {
 }
 
 
+// Replays the frontier policy over the synthetic graph without fetching, so runs are reproducible and fast.
+// Importance of a page is its true inbound link count in the whole graph.
+void simulateCrawl(const string &name, CrawlPolicy policy, const vector<Url> &seeds, unordered_map<Url, vector<Url>, Hash> &graph, const unordered_map<string, int> &importance, int budget, CrawlGraph *record = nullptr) {
+    Frontier frontier(std::move(policy));
+    for(auto &seed: seeds) frontier.push(seed);
+
+    int crawled = 0, deepest = 0;
+    long long importanceCovered = 0;
+    auto start = chrono::steady_clock::now();
+    while(crawled < budget) {
+        auto url = frontier.pop();
+        if (!url) break;
+        crawled++;
+        deepest = max(deepest, url->depth);
+        auto it = importance.find(url->url);
+        if (it != importance.end()) importanceCovered += it->second;
+        auto &links = graph[*url];
+        if (record) record->addPage(*url, links);
+        frontier.addLinks(*url, links);
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    cout << name << ": crawled " << crawled << "/" << budget
+         << " importance " << importanceCovered
+         << " max depth " << deepest
+         << " dropped(depth) " << frontier.droppedByDepth
+         << " dropped(host) " << frontier.droppedByHost
+         << " " << (crawled ? elapsed / crawled : 0) << " ns/page" << endl;
+}
+
+
+void benchmarkFrontier() {
+    constexpr int TOTAL_URLS = 20000;
+    constexpr int BUDGET = 2000;
+    auto [urls, graph] = createWebData(TOTAL_URLS, 42, 4, 3.0, false);
+    unordered_map<string, int> importance;
+    for(auto &[url, links]: graph) {
+        for(auto &link: links) importance[link.url]++;
+    }
+    vector<Url> seeds(urls.end() - 5, urls.end());
+
+    cout << "\nFrontier coverage, " << TOTAL_URLS << " pages, budget " << BUDGET << endl;
+    simulateCrawl("fifo", {CrawlPriority::FIFO}, seeds, graph, importance, BUDGET);
+    simulateCrawl("depth", {CrawlPriority::DEPTH}, seeds, graph, importance, BUDGET);
+    simulateCrawl("inbound", {CrawlPriority::INBOUND_LINKS}, seeds, graph, importance, BUDGET);
+    simulateCrawl("inbound, max depth 4", {CrawlPriority::INBOUND_LINKS, 4}, seeds, graph, importance, BUDGET);
+    simulateCrawl("inbound, 2 pages per host", {CrawlPriority::INBOUND_LINKS, numeric_limits<int>::max(), 2}, seeds, graph, importance, BUDGET);
+    CrawlPolicy custom{CrawlPriority::CUSTOM};
+    custom.score = [](const Url &url, int inboundLinks) -> double {
+        return inboundLinks - 0.5 * url.depth;
+    };
+    simulateCrawl("custom", custom, seeds, graph, importance, BUDGET);
+}
+
+
+// Synthetic pages: shared site boilerplate, a body drawn from a small vocabulary, and some mirrored pages.
+vector<pair<string, string>> createPageData(const vector<Url> &urls, unsigned seed) {
+    mt19937 gen(seed);
+    vector<string> vocabulary;
+    for(int i = 0; i < 2000; i++) vocabulary.push_back("word" + to_string(gen() % 100000));
+    string header = "<html><head><title>site</title><style>";
+    for(int i = 0; i < 200; i++) header += ".class" + to_string(i) + " { margin: " + to_string(i % 7) + "px; }\n";
+    header += "</style></head><body><nav>";
+    for(int i = 0; i < 100; i++) header += "<a href=\"/section" + to_string(i) + "\">Section " + to_string(i) + "</a>";
+    header += "</nav>";
+    string footer = "<footer>Copyright, privacy policy, terms of service, contact us</footer></body></html>";
+
+    uniform_int_distribution<> words(200, 2000);
+    uniform_int_distribution<> mirror(0, 9);
+    vector<pair<string, string>> pages;
+    for(auto &url: urls) {
+        if (!pages.empty() and mirror(gen) == 0) {
+            pages.push_back({url.url, pages[gen() % pages.size()].second});
+            continue;
+        }
+        string body = "<main><h1>" + url.url + "</h1><p>";
+        int count = words(gen);
+        for(int i = 0; i < count; i++) body += vocabulary[gen() % vocabulary.size()] + " ";
+        body += "</p></main>";
+        pages.push_back({url.url, header + body + footer});
+    }
+    return pages;
+}
+
+
+void benchmarkPageStore() {
+    constexpr int TOTAL_PAGES = 5000;
+    auto [urls, graph] = createWebData(TOTAL_PAGES, 7, 4, 1.0, false);
+    auto pageData = createPageData(urls, 7);
+
+    PageStore store("CrawlStoreBench", 16 << 20);
+    auto start = chrono::steady_clock::now();
+    for(auto &[url, content]: pageData) store.put(url, content);
+    auto writeMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    size_t mismatches = 0;
+    for(auto &[url, content]: pageData) {
+        auto stored = store.get(url);
+        if (!stored or *stored != content) mismatches++;
+    }
+    auto readMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    auto &stats = store.statistics();
+    cout << "\nPage store, " << stats.pages << " pages (" << stats.duplicatePages << " duplicates), " << stats.segments << " segments" << endl;
+    cout << "raw " << stats.rawBytes << " B, after dedup " << stats.uniqueBytes << " B, on disk " << stats.storedBytes << " B" << endl;
+    cout << "chunks " << stats.chunks << " unique " << stats.uniqueChunks
+         << ", dedup " << stats.dedupRatio() << "x, compression " << stats.compressionRatio() << "x, total " << stats.storageRatio() << "x" << endl;
+    cout << "write " << writeMs << " ms, read back " << readMs << " ms, mismatches " << mismatches << endl;
+}
+
+
+void benchmarkCrawlGraph() {
+    constexpr int TOTAL_URLS = 20000;
+    constexpr int BUDGET = 2000;
+    auto [urls, graph] = createWebData(TOTAL_URLS, 42, 4, 3.0, false);
+    unordered_map<string, int> importance;
+    size_t mapBytes = 0;
+    for(auto &[url, links]: graph) {
+        mapBytes += sizeof(Url) + url.url.capacity() + sizeof(vector<Url>);
+        for(auto &link: links) {
+            importance[link.url]++;
+            mapBytes += sizeof(Url) + link.url.capacity();
+        }
+    }
+    vector<Url> seeds(urls.end() - 5, urls.end());
+
+    cout << "\nCrawl graph export" << endl;
+    CrawlGraph crawlGraph;
+    simulateCrawl("full crawl", {CrawlPriority::FIFO}, seeds, graph, importance, TOTAL_URLS, &crawlGraph);
+
+    auto start = chrono::steady_clock::now();
+    CsrGraph csr = crawlGraph.toCsr();
+    auto buildUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    const string path = (filesystem::temp_directory_path() / "crawl_graph.csr").string();
+    csr.save(path);
+    auto loaded = CsrGraph::load(path);
+    cout << "nodes " << csr.nodes() << " edges " << csr.edges() << ", csr built in " << buildUs << " us" << endl;
+    cout << "memory: map of Url vectors ~" << mapBytes << " B, csr " << csr.memoryBytes() << " B, file " << filesystem::file_size(path) << " B"
+         << ", reload " << (loaded and loaded->targets == csr.targets and loaded->offsets == csr.offsets ? "ok" : "MISMATCH") << endl;
+
+    // A truncated file and a target past the last node must both fail to load.
+    filesystem::resize_file(path, filesystem::file_size(path) - 1);
+    bool truncatedRejected = !CsrGraph::load(path);
+    CsrGraph outOfRange;
+    outOfRange.urls = {"a", "b"};
+    outOfRange.offsets = {0, 1, 1};
+    outOfRange.targets = {2};
+    outOfRange.save(path);
+    bool outOfRangeRejected = !CsrGraph::load(path);
+    filesystem::remove(path);
+    cout << "corrupt files " << (truncatedRejected and outOfRangeRejected ? "rejected" : "ACCEPTED") << endl;
+
+    vector<double> rank;
+    for(int threads: {1, 2, 4, 8}) {
+        start = chrono::steady_clock::now();
+        rank = pageRank(csr, threads);
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        cout << "pagerank " << threads << " threads: " << ms << " ms" << endl;
+    }
+
+    // Score the next crawl with the ranks of the previous one.
+    CrawlPolicy ranked{CrawlPriority::CUSTOM};
+    auto &ids = crawlGraph.ids();
+    ranked.score = [&ids, &rank](const Url &url, int) -> double {
+        auto id = ids.find(url.url);
+        return id ? rank[*id] : 0;
+    };
+    simulateCrawl("inbound", {CrawlPriority::INBOUND_LINKS}, seeds, graph, importance, BUDGET);
+    simulateCrawl("pagerank of previous crawl", ranked, seeds, graph, importance, BUDGET);
+}
+
+
 int main () {
 
 
     auto pool = make_unique<Threadpool>(10);
     auto [urls, urlGraph] = createWebData();
     vector<Url> seeds;
-    std::uniform_int_distribution<int> dist(0, urls.size() - 1);
 
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
     urlGraph[Url("base")] = urls;
     seeds.push_back(Url("base"));
 
 
-    WebCrawler crawler(seeds, std::move(pool), urls, urlGraph);
+    WebCrawler crawler(seeds, std::move(pool), urls, urlGraph, {CrawlPriority::INBOUND_LINKS, 3});
 
 
     crawler.crawl();
 
 
     cout << "Parsed " << crawler.visited.size() << " websites" << endl;
+    auto &stats = crawler.pages().statistics();
+    cout << "Link graph " << crawler.linkGraph().ids().size() << " urls, " << crawler.linkGraph().edges() << " links" << endl;
+    cout << "Stored " << stats.pages << " pages, " << stats.rawBytes << " B raw, " << stats.storedBytes << " B on disk" << endl;
 
 
-
-
-}
+    benchmarkFrontier();
+    benchmarkPageStore();
+    benchmarkCrawlGraph();
+}
\ No newline at end of file
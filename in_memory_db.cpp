@@ -37,6 +37,39 @@ Schema(funct1, funct1)
 #include <functional>
 #include <memory>
 #include <iostream>
+#include <optional>
+#include <variant>
+#include <charconv>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <climits>
+#include <cctype>
+#include <cassert>
+#include <map>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdexcept>
+#include <regex>
+#include <cmath>
+#include <type_traits>
+#include <fstream>
+#include <filesystem>
+#include <string_view>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -48,53 +81,121 @@ enum class DataType {
     FLOAT,
 };
 
+// A typed cell. The string constructor parses once, a string that does not parse as the type gives a null value.
 class Value {
-    string value;
+    using Storage = variant<monostate, int32_t, int64_t, double, float, string>;
+    Storage value;
     DataType type;
+
+    template<typename T>
+    static Storage parse(const string &text) {
+        T v{};
+        auto [end, ec] = from_chars(text.data(), text.data() + text.size(), v);
+        if (ec != errc() or end != text.data() + text.size()) return monostate();
+        return v;
+    }
+
+    template<typename T>
+    static string format(T v) {
+        char buffer[64];
+        auto [end, ec] = to_chars(buffer, buffer + sizeof(buffer), v);
+        return string(buffer, end);
+    }
+
+    template<typename T>
+    optional<T> numeric() const {
+        switch (value.index()) {
+            case 1: return (T)get<int32_t>(value);
+            case 2: return (T)get<int64_t>(value);
+            case 3: return (T)get<double>(value);
+            case 4: return (T)get<float>(value);
+            case 5: {
+                auto parsed = parse<T>(get<string>(value));
+                if (parsed.index() == 0) return nullopt;
+                return get<T>(parsed);
+            }
+        }
+        return nullopt;
+    }
+
+    Value(DataType type, Storage value): value(std::move(value)), type(type) {}
+
     public:
-    Value(const string &&value, const DataType& type): value(value), type(type) {};
-    
-    optional<int> getInteger() const {
-        try {
-            return stoi(value);
-        } catch (...) {
-            return nullopt;
+    Value(const string &&value, const DataType& type): type(type) {
+        switch (type) {
+            case DataType::INT: this->value = parse<int32_t>(value); break;
+            case DataType::LONG_LONG_INT: this->value = parse<int64_t>(value); break;
+            case DataType::DOUBLE: this->value = parse<double>(value); break;
+            case DataType::FLOAT: this->value = parse<float>(value); break;
+            case DataType::STRING: this->value = value; break;
         }
+    };
+    explicit Value(int32_t v): value(v), type(DataType::INT) {}
+    explicit Value(int64_t v): value(v), type(DataType::LONG_LONG_INT) {}
+    explicit Value(double v): value(v), type(DataType::DOUBLE) {}
+    explicit Value(float v): value(v), type(DataType::FLOAT) {}
+
+    static Value null(DataType type) {
+        return Value(type, monostate());
+    }
+
+    bool isNull() const {
+        return value.index() == 0;
+    }
+
+    optional<int> getInteger() const {
+        return numeric<int32_t>();
     }
 
     optional<long long> getLongInteger() const {
-        try {
-            return stoll(value);
-        } catch (...) {
-            return nullopt;
-        }
+        return numeric<int64_t>();
     }
 
     string get_string() const {
-        return value;
+        switch (value.index()) {
+            case 1: return format(get<int32_t>(value));
+            case 2: return format(get<int64_t>(value));
+            case 3: return format(get<double>(value));
+            case 4: return format(get<float>(value));
+            case 5: return get<string>(value);
+        }
+        return "";
     }
 
     optional<double> get_double() const {
-        try {
-            return stod(value);
-        } catch(...) {
-            return nullopt;
-        }
+        return numeric<double>();
+    }
+
+    optional<float> getFloat() const {
+        return numeric<float>();
     }
 
     DataType getType() const {
         return type;
     }
 
+    // Typed access without conversion, the caller knows the column type.
+    template<typename T>
+    const T &as() const {
+        return get<T>(value);
+    }
+
     bool operator ==(const Value& other) const {
-        if (other.type != type) return false;
-        return other.get_string() == get_string();
+        return other.type == type and other.value == value;
+    }
+
+    bool operator <(const Value& other) const {
+        return value < other.value;
+    }
+
+    size_t hash() const {
+        return std::hash<Storage>()(value);
     }
 };
 
 struct Hash {
     std::size_t operator()(const Value& v) const {
-        return hash<string>()(v.get_string());
+        return v.hash();
     }
 };
 
@@ -108,116 +209,3186 @@ class Validator {
     }
 };
 
+enum class ConstraintType {
+    NOT_NULL,
+    // Not null, and not empty for strings.
+    REQUIRED,
+    RANGE,
+    LENGTH,
+    REGEX
+};
+
+// Declarative column constraint. Bounds are inclusive, RANGE applies to numeric columns, LENGTH and REGEX to strings.
+struct Constraint {
+    int column;
+    ConstraintType type;
+    double low = 0, high = 0;
+    string pattern;
+
+    Constraint(int column, ConstraintType type, double low = 0, double high = 0, string pattern = ""):
+    column(column), type(type), low(low), high(high), pattern(std::move(pattern)) {}
+
+    static Constraint notNull(int column) {return {column, ConstraintType::NOT_NULL};}
+    static Constraint required(int column) {return {column, ConstraintType::REQUIRED};}
+    static Constraint range(int column, double low, double high) {return {column, ConstraintType::RANGE, low, high};}
+    static Constraint length(int column, size_t low, size_t high) {return {column, ConstraintType::LENGTH, (double)low, (double)high};}
+    static Constraint regex(int column, string pattern) {return {column, ConstraintType::REGEX, 0, 0, std::move(pattern)};}
+};
+
+// Constraints compiled against the column types: a flat list of instructions, each bound to one typed check and run
+// over every row of a batch before the next one. Rows that failed are skipped by later instructions.
+class ValidationProgram {
+    enum Opcode {SHAPE, NOT_NULL, REQUIRED, RANGE_INT, RANGE_LONG_LONG_INT, RANGE_FLOAT, RANGE_DOUBLE, LENGTH, REGEX};
+    struct Instruction {
+        Opcode op;
+        int column;
+        int64_t lowInteger = 0, highInteger = 0;
+        double low = 0, high = 0;
+        int regex = -1;
+        string error;
+
+        Instruction(Opcode op, int column): op(op), column(column) {}
+    };
+    vector<DataType> types;
+    vector<Instruction> program;
+    vector<std::regex> regexes;
+
+    template<typename Check>
+    static void each(const vector<vector<Value>> &rows, int column, vector<string> &errors, const string &error, Check check) {
+        for(size_t i = 0; i < rows.size(); i++) {
+            if (errors[i].empty() and !rows[i][column].isNull() and !check(rows[i][column])) errors[i] = error;
+        }
+    }
+
+    public:
+    ValidationProgram(const vector<DataType> &types, const vector<Constraint> &constraints): types(types) {
+        program.push_back({SHAPE, -1});
+        // Null checks go first so the typed checks after them only see values.
+        auto ordered = constraints;
+        stable_partition(ordered.begin(), ordered.end(), [](const Constraint &c) {
+            return c.type == ConstraintType::NOT_NULL or c.type == ConstraintType::REQUIRED;
+        });
+        for(auto &constraint: ordered) {
+            if (constraint.column < 0 or constraint.column >= (int)types.size()) throw invalid_argument("Constraint on unknown column");
+            DataType type = types[constraint.column];
+            string where = "column " + to_string(constraint.column);
+            Instruction instruction{NOT_NULL, constraint.column};
+            switch (constraint.type) {
+                case ConstraintType::NOT_NULL:
+                    instruction.error = where + " is null";
+                    break;
+                case ConstraintType::REQUIRED:
+                    instruction.op = REQUIRED;
+                    instruction.error = where + " is required";
+                    break;
+                case ConstraintType::RANGE:
+                    switch (type) {
+                        case DataType::INT: instruction.op = RANGE_INT; break;
+                        case DataType::LONG_LONG_INT: instruction.op = RANGE_LONG_LONG_INT; break;
+                        case DataType::FLOAT: instruction.op = RANGE_FLOAT; break;
+                        case DataType::DOUBLE: instruction.op = RANGE_DOUBLE; break;
+                        case DataType::STRING: throw invalid_argument("RANGE on a string column");
+                    }
+                    instruction.lowInteger = (int64_t)ceil(constraint.low);
+                    instruction.highInteger = (int64_t)floor(constraint.high);
+                    instruction.low = constraint.low;
+                    instruction.high = constraint.high;
+                    instruction.error = where + " is out of range";
+                    break;
+                case ConstraintType::LENGTH:
+                    if (type != DataType::STRING) throw invalid_argument("LENGTH on a non string column");
+                    instruction.op = LENGTH;
+                    instruction.lowInteger = (int64_t)constraint.low;
+                    instruction.highInteger = (int64_t)constraint.high;
+                    instruction.error = where + " has the wrong length";
+                    break;
+                case ConstraintType::REGEX:
+                    if (type != DataType::STRING) throw invalid_argument("REGEX on a non string column");
+                    instruction.op = REGEX;
+                    instruction.regex = regexes.size();
+                    regexes.emplace_back(constraint.pattern, std::regex::optimize);
+                    instruction.error = where + " does not match " + constraint.pattern;
+                    break;
+            }
+            program.push_back(std::move(instruction));
+        }
+    }
+
+    // errors[i] is left empty for valid rows and gets the first failed check otherwise.
+    void run(const vector<vector<Value>> &rows, vector<string> &errors) const {
+        errors.assign(rows.size(), "");
+        for(auto &ins: program) {
+            switch (ins.op) {
+                case SHAPE:
+                    for(size_t i = 0; i < rows.size(); i++) {
+                        if (rows[i].size() != types.size()) {
+                            errors[i] = "Wrong number of columns";
+                            continue;
+                        }
+                        for(size_t c = 0; c < types.size(); c++) {
+                            if (rows[i][c].getType() != types[c]) errors[i] = "Wrong types provided";
+                        }
+                    }
+                    break;
+                case NOT_NULL:
+                    for(size_t i = 0; i < rows.size(); i++) {
+                        if (errors[i].empty() and rows[i][ins.column].isNull()) errors[i] = ins.error;
+                    }
+                    break;
+                case REQUIRED:
+                    for(size_t i = 0; i < rows.size(); i++) {
+                        if (!errors[i].empty()) continue;
+                        auto &value = rows[i][ins.column];
+                        if (value.isNull() or (value.getType() == DataType::STRING and value.as<string>().empty())) errors[i] = ins.error;
+                    }
+                    break;
+                case RANGE_INT:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        return v.as<int32_t>() >= ins.lowInteger and v.as<int32_t>() <= ins.highInteger;
+                    });
+                    break;
+                case RANGE_LONG_LONG_INT:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        return v.as<int64_t>() >= ins.lowInteger and v.as<int64_t>() <= ins.highInteger;
+                    });
+                    break;
+                case RANGE_FLOAT:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        return v.as<float>() >= ins.low and v.as<float>() <= ins.high;
+                    });
+                    break;
+                case RANGE_DOUBLE:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        return v.as<double>() >= ins.low and v.as<double>() <= ins.high;
+                    });
+                    break;
+                case LENGTH:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        int64_t length = v.as<string>().size();
+                        return length >= ins.lowInteger and length <= ins.highInteger;
+                    });
+                    break;
+                case REGEX:
+                    each(rows, ins.column, errors, ins.error, [&](const Value &v) {
+                        return regex_match(v.as<string>(), regexes[ins.regex]);
+                    });
+                    break;
+            }
+        }
+    }
+};
+
 enum class SecondaryIndexTypes {
     INVERTED,
     SORTED,
     HASH
 };
 
-class Row {
-    public:
-    vector<Value> values;
-    Row(vector<Value>& values): values(values) {}
-};
 class Schema {
     int columnNum;
     vector<DataType> types;
     unordered_map<int, shared_ptr<Validator>> validators;
     int primaryKeyIndex;
     vector<pair<int, SecondaryIndexTypes>> secondaryIndexes;
+    ValidationProgram program;
     public:
-    Schema(int columns, const vector<DataType>& types, unordered_map<int, shared_ptr<Validator>> &validators, int primaryKeyIndex = 0):
+    Schema(int columns, const vector<DataType>& types, unordered_map<int, shared_ptr<Validator>> &validators, int primaryKeyIndex = 0,
+           const vector<pair<int, SecondaryIndexTypes>> &secondaryIndexes = {}, const vector<Constraint> &constraints = {}):
     columnNum(columns),
     types(types),
     validators(move(validators)),
     primaryKeyIndex(primaryKeyIndex),
-    secondaryIndexes(secondaryIndexes)
+    secondaryIndexes(secondaryIndexes),
+    program(types, constraints)
 
     {}
 
-    int getPrimaryKeyIndex() {return primaryKeyIndex;}
-    bool validate(const unique_ptr<Row> & row) {
-        if (columnNum != types.size())  return false;
+    int getPrimaryKeyIndex() const {return primaryKeyIndex;}
+    int getColumnNum() const {return columnNum;}
+    const vector<DataType> &getTypes() const {return types;}
+    const vector<pair<int, SecondaryIndexTypes>> &getSecondaryIndexes() const {return secondaryIndexes;}
+
+    // Compiled constraints over the whole batch, then the custom validators on the rows still valid.
+    vector<string> validateBatch(const vector<vector<Value>> &rows) {
+        vector<string> errors;
+        program.run(rows, errors);
+        if (columnNum != (int)types.size()) errors.assign(rows.size(), "Wrong types provided");
         for(auto &[index, validator]: validators) {
-            if (index >= columnNum) return false;
-            if (!validator->validate(row->values[index], types[index])) return false; 
+            for(size_t i = 0; i < rows.size(); i++) {
+                if (!errors[i].empty()) continue;
+                if (index >= columnNum or !validator->validate(rows[i][index], types[index])) errors[i] = "Wrong types provided";
+            }
         }
+        return errors;
+    }
 
-        return true;
+    optional<string> error(const vector<Value> &values) {
+        auto errors = validateBatch({values});
+        if (errors[0].empty()) return nullopt;
+        return errors[0];
+    }
+
+    bool validate(const vector<Value> &values) {
+        return !error(values);
     }
 };
 
-class Table {
-    shared_ptr<Schema> schema;
-    vector<unique_ptr<Row>> rows;
-    unordered_map<Value, int, Hash> primaryIndex;
-    int numOfRows;
+// Fixed size blocks, so appending never moves existing cells and a block is one contiguous typed array.
+// The block directory is allocated at its full size, so one appending writer never moves anything a reader holds;
+// cells below size() are published by the release store of the count.
+constexpr size_t BLOCK_SHIFT = 12;
+constexpr size_t BLOCK_ROWS = 1 << BLOCK_SHIFT;
+constexpr size_t MAX_BLOCKS = 1 << 14;
+
+template<typename T>
+class BlockVector {
+    unique_ptr<unique_ptr<T[]>[]> blocks;
+    atomic<size_t> count;
     public:
-    Table(shared_ptr<Schema> schema):schema(std::move(schema)), numOfRows(0) {}
-    pair<int, string> insert(vector<Value> &values) {
-        auto row = make_unique<Row>(values);
-        if (!schema->validate(row)) {
-            return {-1, "Wrong types provided"};
+    BlockVector(): count(0) {}
+
+    void push_back(const T &v) {
+        size_t n = count.load(memory_order_relaxed);
+        if (!blocks) blocks = make_unique<unique_ptr<T[]>[]>(MAX_BLOCKS);
+        if ((n & (BLOCK_ROWS - 1)) == 0) {
+            if ((n >> BLOCK_SHIFT) == MAX_BLOCKS) throw length_error("BlockVector is full");
+            blocks[n >> BLOCK_SHIFT] = make_unique<T[]>(BLOCK_ROWS);
         }
-        int index = rows.size();
-        rows.emplace_back(std::move(row));
-        primaryIndex[row->values[schema->getPrimaryKeyIndex()]] = index;
-        return {0, "Inserted succesfully"};
+        blocks[n >> BLOCK_SHIFT][n & (BLOCK_ROWS - 1)] = v;
+        count.store(n + 1, memory_order_release);
     }
 
-    bool remove(const Value& value) {
-        // Assuming the value is primary key
-        if (primaryIndex.find(value) == primaryIndex.end()) return false;
-        primaryIndex.erase(value);
-        return true;
+    // Bulk append, one copy per block touched.
+    void append(const T *cells, size_t n) {
+        size_t size = count.load(memory_order_relaxed);
+        if (!blocks) blocks = make_unique<unique_ptr<T[]>[]>(MAX_BLOCKS);
+        while (n) {
+            size_t offset = size & (BLOCK_ROWS - 1);
+            if (offset == 0) {
+                if ((size >> BLOCK_SHIFT) == MAX_BLOCKS) throw length_error("BlockVector is full");
+                blocks[size >> BLOCK_SHIFT] = make_unique_for_overwrite<T[]>(BLOCK_ROWS);
+            }
+            size_t take = min(n, BLOCK_ROWS - offset);
+            copy(cells, cells + take, &blocks[size >> BLOCK_SHIFT][offset]);
+            cells += take;
+            n -= take;
+            size += take;
+            count.store(size, memory_order_release);
+        }
     }
 
-    bool update(vector<Value> &values) {
-        const auto &value = values[schema->getPrimaryKeyIndex()];
-        if (primaryIndex.find(value) == primaryIndex.end()) return false;
-        int index = primaryIndex[value];
-        auto &row = rows[index];
-        row->values = values;
-        return true;
+    // Drops cells from n on and frees their whole blocks. No reader may still look at them.
+    void truncate(size_t n) {
+        size_t used = blockCount();
+        count.store(n, memory_order_release);
+        for(size_t b = (n + BLOCK_ROWS - 1) >> BLOCK_SHIFT; b < used; b++) blocks[b].reset();
     }
 
-    void printRows() {
-        for(auto &row : rows) {
-            for(auto &value: row->values) cout << value.get_string() <<" ";
-            cout << endl; 
+    T &operator[](size_t i) {
+        return blocks[i >> BLOCK_SHIFT][i & (BLOCK_ROWS - 1)];
+    }
+
+    const T &operator[](size_t i) const {
+        return blocks[i >> BLOCK_SHIFT][i & (BLOCK_ROWS - 1)];
+    }
+
+    size_t size() const {
+        return count.load(memory_order_acquire);
+    }
+
+    size_t blockCount() const {
+        return (size() + BLOCK_ROWS - 1) >> BLOCK_SHIFT;
+    }
+
+    const T *block(size_t b) const {
+        return blocks[b].get();
+    }
+
+    // Rows used in block b, only the last block can be partial.
+    size_t blockSize(size_t b) const {
+        return min(BLOCK_ROWS, size() - (b << BLOCK_SHIFT));
+    }
+};
+
+class Bitmap {
+    vector<uint64_t> words;
+    size_t bits;
+    public:
+    Bitmap(size_t bits = 0, bool value = false): words((bits + 63) / 64, value ? ~0ULL : 0), bits(bits) {
+        if (value and bits % 64) words.back() = (1ULL << (bits % 64)) - 1;
+    }
+
+    void push_back(bool value) {
+        if (bits % 64 == 0) words.push_back(0);
+        bits++;
+        set(bits - 1, value);
+    }
+
+    void set(size_t i, bool value = true) {
+        if (value) words[i >> 6] |= 1ULL << (i & 63);
+        else words[i >> 6] &= ~(1ULL << (i & 63));
+    }
+
+    bool test(size_t i) const {
+        return words[i >> 6] >> (i & 63) & 1;
+    }
+
+    size_t size() const {
+        return bits;
+    }
+
+    size_t count() const {
+        size_t total = 0;
+        for(auto w: words) total += __builtin_popcountll(w);
+        return total;
+    }
+
+    void resize(size_t n) {
+        words.resize((n + 63) / 64);
+        bits = n;
+        if (n % 64) words.back() &= (1ULL << (n % 64)) - 1;
+    }
+
+    // Last set bit at or before i, -1 when there is none.
+    long prevSet(long i) const {
+        if (i < 0) return -1;
+        long w = i >> 6;
+        uint64_t word = words[w] & (~0ULL >> (63 - (i & 63)));
+        while (!word) {
+            if (--w < 0) return -1;
+            word = words[w];
+        }
+        return (w << 6) + 63 - __builtin_clzll(word);
+    }
+
+    // First set bit at or after i, size() when there is none.
+    size_t nextSet(size_t i) const {
+        if (i >= bits) return bits;
+        size_t w = i >> 6;
+        uint64_t word = words[w] & (~0ULL << (i & 63));
+        while (!word) {
+            if (++w == words.size()) return bits;
+            word = words[w];
         }
+        return min(bits, (w << 6) + __builtin_ctzll(word));
+    }
+
+    void andWith(const Bitmap &other) {
+        for(size_t i = 0; i < words.size(); i++) words[i] &= i < other.words.size() ? other.words[i] : 0;
+    }
+
+    void orWith(const Bitmap &other) {
+        for(size_t i = 0; i < words.size() and i < other.words.size(); i++) words[i] |= other.words[i];
+    }
+
+    const vector<uint64_t> &data() const {
+        return words;
+    }
+
+    vector<uint64_t> &data() {
+        return words;
     }
 };
 
+// Strings are stored once per column and cells hold their code. Decoding is lock free since strings never move,
+// the code map is shared locked for lookups.
+class Dictionary {
+    BlockVector<string> strings;
+    unordered_map<string, uint32_t> codes;
+    mutable shared_mutex lock;
+    public:
+    uint32_t encode(const string &s) {
+        unique_lock guard(lock);
+        auto [it, inserted] = codes.try_emplace(s, strings.size());
+        if (inserted) strings.push_back(s);
+        return it->second;
+    }
 
+    optional<uint32_t> find(const string &s) const {
+        shared_lock guard(lock);
+        auto it = codes.find(s);
+        if (it == codes.end()) return nullopt;
+        return it->second;
+    }
 
+    const string &decode(uint32_t code) const {
+        return strings[code];
+    }
 
-int main () {
-    auto v1 = make_shared<Validator>([](const Value& value) -> bool {
-        if (value.get_string().size() == 0) return false;
-        cout << value.get_string() << endl;
-        return value.get_string() > "a" and value.get_string() < "y";
-    });
+    size_t size() const {
+        return strings.size();
+    }
+};
 
-    auto v2 = make_shared<Validator>([](const Value& value) -> bool {
-        cout << value.get_string() << endl;
-        return value.getInteger() >= 10;
-    });
+// One typed column, only the storage matching `type` is used. Null cells keep a zero in storage and a 0 bit in valid.
+// Validity words are shared by neighbouring rows, so they are written and read atomically.
+class Column {
+    DataType type;
+    BlockVector<int32_t> ints;
+    BlockVector<int64_t> longs;
+    BlockVector<double> doubles;
+    BlockVector<float> floats;
+    BlockVector<uint32_t> codes;
+    Dictionary dictionary;
+    BlockVector<uint64_t> valid;
+    atomic<size_t> rows;
 
-    auto v3 = make_shared<Validator>([](const Value& value) -> bool {
-        cout << value.get_string() << endl;
-        return value.get_double() >= 4.5;
-    });
+    void store(size_t row, const Value &value) {
+        bool isNull = value.isNull();
+        switch (type) {
+            case DataType::INT: ints[row] = isNull ? 0 : value.as<int32_t>(); break;
+            case DataType::LONG_LONG_INT: longs[row] = isNull ? 0 : value.as<int64_t>(); break;
+            case DataType::DOUBLE: doubles[row] = isNull ? 0 : value.as<double>(); break;
+            case DataType::FLOAT: floats[row] = isNull ? 0 : value.as<float>(); break;
+            case DataType::STRING: codes[row] = isNull ? 0 : dictionary.encode(value.as<string>()); break;
+        }
+        uint64_t bit = 1ULL << (row & 63);
+        if (isNull) __atomic_fetch_and(&valid[row >> 6], ~bit, __ATOMIC_RELAXED);
+        else __atomic_fetch_or(&valid[row >> 6], bit, __ATOMIC_RELAXED);
+    }
 
-    unordered_map<int, shared_ptr<Validator>> validators = {
-        {0, std::move(v1)},
-        {1, std::move(v2)},
-        {2, std::move(v3)}
-    } ;
-    auto schema = make_shared<Schema>(3, vector<DataType>({DataType::STRING, DataType::INT, DataType::DOUBLE}), validators);
-    Table t(schema);
-    vector<Value> values = vector<Value>({ Value("Ritwiz", DataType::STRING), Value("100", DataType::INT), Value("1866.5", DataType::DOUBLE)});
-    auto [result, message] = t.insert(values);
-    cout << message << endl;
-    t.printRows();
+    public:
+    explicit Column(DataType type): type(type), rows(0) {}
+
+    DataType getType() const {
+        return type;
+    }
+
+    size_t size() const {
+        return rows.load(memory_order_acquire);
+    }
+
+    void append(const Value &value) {
+        size_t row = rows.load(memory_order_relaxed);
+        switch (type) {
+            case DataType::INT: ints.push_back(0); break;
+            case DataType::LONG_LONG_INT: longs.push_back(0); break;
+            case DataType::DOUBLE: doubles.push_back(0); break;
+            case DataType::FLOAT: floats.push_back(0); break;
+            case DataType::STRING: codes.push_back(0); break;
+        }
+        if (row % 64 == 0) valid.push_back(0);
+        store(row, value);
+        rows.store(row + 1, memory_order_release);
+    }
+
+    void set(size_t row, const Value &value) {
+        store(row, value);
+    }
+
+    // Bulk append of n cells in storage form, dictionary codes for strings, with one validity bit per cell.
+    template<typename T>
+    void appendRaw(const T *cells, const uint64_t *validity, size_t n) {
+        size_t row = rows.load(memory_order_relaxed);
+        const_cast<BlockVector<T>&>(values<T>()).append(cells, n);
+        if (row % 64 == 0) valid.append(validity, (n + 63) / 64);
+        else {
+            for(size_t i = 0; i < n; i++) {
+                if ((row + i) % 64 == 0) valid.push_back(0);
+                if (validity[i >> 6] >> (i & 63) & 1) __atomic_fetch_or(&valid[(row + i) >> 6], 1ULL << ((row + i) & 63), __ATOMIC_RELAXED);
+            }
+        }
+        rows.store(row + n, memory_order_release);
+    }
+
+    void truncate(size_t n) {
+        ints.truncate(min(ints.size(), n));
+        longs.truncate(min(longs.size(), n));
+        doubles.truncate(min(doubles.size(), n));
+        floats.truncate(min(floats.size(), n));
+        codes.truncate(min(codes.size(), n));
+        valid.truncate((n + 63) / 64);
+        if (n % 64) __atomic_fetch_and(&valid[n / 64], (1ULL << (n % 64)) - 1, __ATOMIC_RELAXED);
+        rows.store(n, memory_order_release);
+    }
+
+    bool isNull(size_t row) const {
+        return !(__atomic_load_n(&valid[row >> 6], __ATOMIC_RELAXED) >> (row & 63) & 1);
+    }
+
+    // Clears the selection bits of null cells among the first `count` rows.
+    void maskNulls(vector<uint64_t> &selection, size_t count) const {
+        for(size_t w = 0; w < (count + 63) / 64; w++) selection[w] &= __atomic_load_n(&valid[w], __ATOMIC_RELAXED);
+    }
+
+    Value get(size_t row) const {
+        if (isNull(row)) return Value::null(type);
+        switch (type) {
+            case DataType::INT: return Value(ints[row]);
+            case DataType::LONG_LONG_INT: return Value(longs[row]);
+            case DataType::DOUBLE: return Value(doubles[row]);
+            case DataType::FLOAT: return Value(floats[row]);
+            case DataType::STRING: return Value(string(dictionary.decode(codes[row])), DataType::STRING);
+        }
+        return Value::null(type);
+    }
+
+    template<typename T> const BlockVector<T> &values() const;
+
+    const Dictionary &dict() const {
+        return dictionary;
+    }
+
+    Dictionary &dict() {
+        return dictionary;
+    }
+};
+
+template<> const BlockVector<int32_t> &Column::values() const { return ints; }
+template<> const BlockVector<int64_t> &Column::values() const { return longs; }
+template<> const BlockVector<double> &Column::values() const { return doubles; }
+template<> const BlockVector<float> &Column::values() const { return floats; }
+template<> const BlockVector<uint32_t> &Column::values() const { return codes; }
+
+// Row ids of a key are kept sorted so the query side can merge them without sorting.
+static void insertSorted(vector<int> &rows, int row) {
+    rows.insert(lower_bound(rows.begin(), rows.end(), row), row);
+}
+
+static void eraseSorted(vector<int> &rows, int row) {
+    auto it = lower_bound(rows.begin(), rows.end(), row);
+    if (it != rows.end() and *it == row) rows.erase(it);
+}
+
+class SecondaryIndex {
+    protected:
+    int columnIndex;
+    public:
+    SecondaryIndex(int column): columnIndex(column) {}
+    virtual ~SecondaryIndex() = default;
+    virtual SecondaryIndexTypes getType() const = 0;
+    virtual void add(const Value &value, int row) = 0;
+    virtual void remove(const Value &value, int row) = 0;
+    // Adds many (value, row) pairs at once, an index may build itself faster from the whole set.
+    virtual void addAll(vector<pair<Value, int>> entries) {
+        for(auto &[value, row]: entries) add(value, row);
+    }
+    // Number of distinct keys, used as the cardinality statistic.
+    virtual size_t distinct() const = 0;
+    int column() const {return columnIndex;}
+};
+
+class HashIndex: public SecondaryIndex {
+    unordered_map<Value, vector<int>, Hash> rows;
+    public:
+    using SecondaryIndex::SecondaryIndex;
+    SecondaryIndexTypes getType() const override {return SecondaryIndexTypes::HASH;}
+
+    void add(const Value &value, int row) override {
+        if (value.isNull()) return;
+        insertSorted(rows[value], row);
+    }
+
+    void remove(const Value &value, int row) override {
+        auto it = rows.find(value);
+        if (it == rows.end()) return;
+        eraseSorted(it->second, row);
+        if (it->second.empty()) rows.erase(it);
+    }
+
+    size_t distinct() const override {return rows.size();}
+
+    const vector<int> &equal(const Value &value) const {
+        static const vector<int> none;
+        auto it = rows.find(value);
+        return it == rows.end() ? none : it->second;
+    }
+};
+
+// B+ tree over (value, row) entries, leaves are linked for range scans. Erase does not rebalance,
+// an underfull leaf stays in place until the next insert fills it.
+class SortedIndex: public SecondaryIndex {
+    using Entry = pair<Value, int>;
+    static constexpr size_t FANOUT = 64;
+    struct Node {
+        bool leaf;
+        vector<Entry> keys;
+        vector<unique_ptr<Node>> children;
+        Node *next = nullptr;
+        Node(bool leaf): leaf(leaf) {}
+    };
+    unique_ptr<Node> root;
+    map<Value, int> counts;
+    size_t entries = 0;
+
+    static size_t childFor(const Node *node, const Entry &entry) {
+        return upper_bound(node->keys.begin(), node->keys.end(), entry) - node->keys.begin();
+    }
+
+    // Returns the separator and right half when `node` splits.
+    optional<pair<Entry, unique_ptr<Node>>> insert(Node *node, const Entry &entry) {
+        if (node->leaf) {
+            node->keys.insert(lower_bound(node->keys.begin(), node->keys.end(), entry), entry);
+            if (node->keys.size() <= FANOUT) return nullopt;
+            auto right = make_unique<Node>(true);
+            right->keys.assign(node->keys.begin() + FANOUT / 2, node->keys.end());
+            node->keys.erase(node->keys.begin() + FANOUT / 2, node->keys.end());
+            right->next = node->next;
+            node->next = right.get();
+            Entry separator = right->keys.front();
+            return make_pair(separator, std::move(right));
+        }
+        size_t i = childFor(node, entry);
+        auto split = insert(node->children[i].get(), entry);
+        if (!split) return nullopt;
+        node->keys.insert(node->keys.begin() + i, split->first);
+        node->children.insert(node->children.begin() + i + 1, std::move(split->second));
+        if (node->keys.size() <= FANOUT) return nullopt;
+        auto right = make_unique<Node>(false);
+        Entry separator = node->keys[FANOUT / 2];
+        right->keys.assign(node->keys.begin() + FANOUT / 2 + 1, node->keys.end());
+        for(size_t c = FANOUT / 2 + 1; c < node->children.size(); c++) right->children.push_back(std::move(node->children[c]));
+        node->keys.erase(node->keys.begin() + FANOUT / 2, node->keys.end());
+        node->children.resize(FANOUT / 2 + 1);
+        return make_pair(separator, std::move(right));
+    }
+
+    Node *leafFor(const Entry &entry) const {
+        Node *node = root.get();
+        while (!node->leaf) node = node->children[childFor(node, entry)].get();
+        return node;
+    }
+
+    public:
+    SortedIndex(int column): SecondaryIndex(column), root(make_unique<Node>(true)) {}
+    SecondaryIndexTypes getType() const override {return SecondaryIndexTypes::SORTED;}
+
+    void add(const Value &value, int row) override {
+        if (value.isNull()) return;
+        auto split = insert(root.get(), {value, row});
+        if (split) {
+            auto top = make_unique<Node>(false);
+            top->keys.push_back(split->first);
+            top->children.push_back(std::move(root));
+            top->children.push_back(std::move(split->second));
+            root = std::move(top);
+        }
+        counts[value]++;
+        entries++;
+    }
+
+    void remove(const Value &value, int row) override {
+        Entry entry = {value, row};
+        Node *leaf = leafFor(entry);
+        auto it = lower_bound(leaf->keys.begin(), leaf->keys.end(), entry);
+        if (it == leaf->keys.end() or !(it->first == value) or it->second != row) return;
+        leaf->keys.erase(it);
+        if (--counts[value] == 0) counts.erase(value);
+        entries--;
+    }
+
+    // Bulk build of an empty tree: the entries are sorted once and packed into leaves three quarters full, then every
+    // level above is built from the first entry of each node.
+    void addAll(vector<Entry> all) override {
+        if (entries) return SecondaryIndex::addAll(std::move(all));
+        all.erase(remove_if(all.begin(), all.end(), [](const Entry &entry) { return entry.first.isNull(); }), all.end());
+        if (all.empty()) return;
+        sort(all.begin(), all.end());
+        constexpr size_t FILL = FANOUT * 3 / 4;
+        vector<unique_ptr<Node>> level;
+        vector<Entry> firsts;
+        size_t leaves = (all.size() + FILL - 1) / FILL;
+        for(size_t i = 0; i < leaves; i++) {
+            auto leaf = make_unique<Node>(true);
+            leaf->keys.assign(all.begin() + all.size() * i / leaves, all.begin() + all.size() * (i + 1) / leaves);
+            if (!level.empty()) level.back()->next = leaf.get();
+            firsts.push_back(leaf->keys.front());
+            level.push_back(std::move(leaf));
+        }
+        while (level.size() > 1) {
+            vector<unique_ptr<Node>> parents;
+            vector<Entry> parentFirsts;
+            size_t nodes = (level.size() + FILL) / (FILL + 1);
+            for(size_t i = 0; i < nodes; i++) {
+                auto node = make_unique<Node>(false);
+                size_t from = level.size() * i / nodes, to = level.size() * (i + 1) / nodes;
+                for(size_t c = from; c < to; c++) {
+                    if (c != from) node->keys.push_back(firsts[c]);
+                    node->children.push_back(std::move(level[c]));
+                }
+                parentFirsts.push_back(firsts[from]);
+                parents.push_back(std::move(node));
+            }
+            level = std::move(parents);
+            firsts = std::move(parentFirsts);
+        }
+        root = std::move(level.front());
+        for(auto &[value, row]: all) counts.emplace_hint(counts.end(), value, 0)->second++;
+        entries = all.size();
+    }
+
+    size_t distinct() const override {return counts.size();}
+
+    size_t size() const {return entries;}
+
+    // Rows expected in [low, high], exact for a single key, interpolated between the smallest and largest key otherwise.
+    size_t estimate(const optional<Value> &low, const optional<Value> &high) const {
+        if (counts.empty()) return 0;
+        if (low and high and *low == *high) {
+            auto it = counts.find(*low);
+            return it == counts.end() ? 0 : it->second;
+        }
+        auto first = counts.begin()->first.get_double(), last = counts.rbegin()->first.get_double();
+        if (!first or !last or counts.begin()->first.getType() == DataType::STRING) return entries / 3;
+        if (*last <= *first) return entries;
+        double from = low ? low->get_double().value_or(*first) : *first, to = high ? high->get_double().value_or(*last) : *last;
+        double fraction = (min(to, *last) - max(from, *first)) / (*last - *first);
+        return (size_t)(max(0.0, min(1.0, fraction)) * entries) + 1;
+    }
+
+    // Rows with a value in the given bounds, an empty bound is open. Result is sorted by row id.
+    vector<int> range(const optional<Value> &low, bool lowInclusive, const optional<Value> &high, bool highInclusive) const {
+        vector<int> result;
+        Node *leaf = root.get();
+        if (low) leaf = leafFor({*low, INT_MIN});
+        else while (!leaf->leaf) leaf = leaf->children.front().get();
+        for(; leaf; leaf = leaf->next) {
+            for(auto &[value, row]: leaf->keys) {
+                if (low and (value < *low or (!lowInclusive and value == *low))) continue;
+                if (high and (*high < value or (!highInclusive and value == *high))) {
+                    sort(result.begin(), result.end());
+                    return result;
+                }
+                result.push_back(row);
+            }
+        }
+        sort(result.begin(), result.end());
+        return result;
+    }
+};
+
+// Lower cased alphanumeric tokens of a string column to the rows containing them.
+class InvertedIndex: public SecondaryIndex {
+    unordered_map<string, vector<int>> postings;
+    public:
+    using SecondaryIndex::SecondaryIndex;
+    SecondaryIndexTypes getType() const override {return SecondaryIndexTypes::INVERTED;}
+
+    static vector<string> tokenize(const string &text) {
+        vector<string> tokens;
+        string token;
+        for(char c: text + ' ') {
+            if (isalnum((unsigned char)c)) token += tolower((unsigned char)c);
+            else if (!token.empty()) {
+                tokens.push_back(std::move(token));
+                token.clear();
+            }
+        }
+        sort(tokens.begin(), tokens.end());
+        tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+        return tokens;
+    }
+
+    void add(const Value &value, int row) override {
+        if (value.isNull()) return;
+        for(auto &token: tokenize(value.get_string())) insertSorted(postings[token], row);
+    }
+
+    void remove(const Value &value, int row) override {
+        if (value.isNull()) return;
+        for(auto &token: tokenize(value.get_string())) {
+            auto it = postings.find(token);
+            if (it == postings.end()) continue;
+            eraseSorted(it->second, row);
+            if (it->second.empty()) postings.erase(it);
+        }
+    }
+
+    size_t distinct() const override {return postings.size();}
+
+    const vector<int> &token(const string &token) const {
+        static const vector<int> none;
+        auto it = postings.find(token);
+        return it == postings.end() ? none : it->second;
+    }
+};
+
+enum class Operator {
+    EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    CONTAINS
+};
+
+template<typename T>
+static bool compare(T cell, Operator op, T constant) {
+    switch (op) {
+        case Operator::EQUAL: return cell == constant;
+        case Operator::NOT_EQUAL: return cell != constant;
+        case Operator::LESS: return cell < constant;
+        case Operator::LESS_EQUAL: return cell <= constant;
+        case Operator::GREATER: return cell > constant;
+        case Operator::GREATER_EQUAL: return cell >= constant;
+        default: return false;
+    }
+}
+
+// Selection bits of 64 consecutive cells, one cell at a time. The operator is a template argument so the kernels
+// below have no branch per cell, scanBlocks dispatches on it once per scan.
+template<Operator OP, typename T>
+static uint64_t compare64(const T *cells, T constant) {
+    uint64_t bits = 0;
+    for(int i = 0; i < 64; i++) bits |= (uint64_t)compare(cells[i], OP, constant) << i;
+    return bits;
+}
+
+#if defined(__x86_64__)
+// Same as compare64 with 256 bit compares, 8 lanes for 32 bit cells and 4 for 64 bit ones.
+template<Operator OP, typename T>
+__attribute__((target("avx2"))) static uint64_t compare64Avx2(const T *cells, T constant) {
+    uint64_t bits = 0;
+    if constexpr (sizeof(T) == 4 and is_integral_v<T>) {
+        __m256i c = _mm256_set1_epi32((int32_t)constant);
+        for(int i = 0; i < 64; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(cells + i)), mask;
+            if constexpr (OP == Operator::EQUAL or OP == Operator::NOT_EQUAL) mask = _mm256_cmpeq_epi32(v, c);
+            else if constexpr (OP == Operator::LESS or OP == Operator::GREATER_EQUAL) mask = _mm256_cmpgt_epi32(c, v);
+            else mask = _mm256_cmpgt_epi32(v, c);
+            bits |= (uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(mask)) << i;
+        }
+    } else if constexpr (sizeof(T) == 8 and is_integral_v<T>) {
+        __m256i c = _mm256_set1_epi64x((int64_t)constant);
+        for(int i = 0; i < 64; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(cells + i)), mask;
+            if constexpr (OP == Operator::EQUAL or OP == Operator::NOT_EQUAL) mask = _mm256_cmpeq_epi64(v, c);
+            else if constexpr (OP == Operator::LESS or OP == Operator::GREATER_EQUAL) mask = _mm256_cmpgt_epi64(c, v);
+            else mask = _mm256_cmpgt_epi64(v, c);
+            bits |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(mask)) << i;
+        }
+    } else {
+        constexpr int predicate = OP == Operator::EQUAL ? _CMP_EQ_OQ : OP == Operator::NOT_EQUAL ? _CMP_NEQ_UQ :
+                                  OP == Operator::LESS ? _CMP_LT_OQ : OP == Operator::LESS_EQUAL ? _CMP_LE_OQ :
+                                  OP == Operator::GREATER ? _CMP_GT_OQ : _CMP_GE_OQ;
+        if constexpr (is_same_v<T, float>) {
+            __m256 c = _mm256_set1_ps(constant);
+            for(int i = 0; i < 64; i += 8) {
+                bits |= (uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(cells + i), c, predicate)) << i;
+            }
+        } else {
+            __m256d c = _mm256_set1_pd(constant);
+            for(int i = 0; i < 64; i += 4) {
+                bits |= (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(cells + i), c, predicate)) << i;
+            }
+        }
+        return bits;
+    }
+    // Integer compares only give ==, > and <, the rest are their complements.
+    constexpr bool negate = OP == Operator::NOT_EQUAL or OP == Operator::LESS_EQUAL or OP == Operator::GREATER_EQUAL;
+    return negate ? ~bits : bits;
+}
+
+static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+#else
+static const bool hasAvx2 = false;
+#endif
+
+template<Operator OP, typename T>
+static void scanBlocks(const BlockVector<T> &cells, T constant, size_t rows, bool simd, vector<uint64_t> &out) {
+    for(size_t b = 0; (b << BLOCK_SHIFT) < rows; b++) {
+        const T *block = cells.block(b);
+        size_t n = min(BLOCK_ROWS, rows - (b << BLOCK_SHIFT)), word = (b << BLOCK_SHIFT) >> 6, i = 0;
+        for(; i + 64 <= n; i += 64, word++) {
+#if defined(__x86_64__)
+            if (simd) {
+                out[word] = compare64Avx2<OP>(block + i, constant);
+                continue;
+            }
+#endif
+            out[word] = compare64<OP>(block + i, constant);
+        }
+        uint64_t tail = 0;
+        for(size_t j = 0; i + j < n; j++) tail |= (uint64_t)compare(block[i + j], OP, constant) << j;
+        if (i < n) out[word] = tail;
+    }
+}
+
+// Fills words of `out` for the first `rows` cells of one column, block by block. Later rows stay 0.
+template<typename T>
+static void scanBlocks(const BlockVector<T> &cells, Operator op, T constant, size_t rows, bool simd, vector<uint64_t> &out) {
+    switch (op) {
+        case Operator::EQUAL: return scanBlocks<Operator::EQUAL>(cells, constant, rows, simd, out);
+        case Operator::NOT_EQUAL: return scanBlocks<Operator::NOT_EQUAL>(cells, constant, rows, simd, out);
+        case Operator::LESS: return scanBlocks<Operator::LESS>(cells, constant, rows, simd, out);
+        case Operator::LESS_EQUAL: return scanBlocks<Operator::LESS_EQUAL>(cells, constant, rows, simd, out);
+        case Operator::GREATER: return scanBlocks<Operator::GREATER>(cells, constant, rows, simd, out);
+        case Operator::GREATER_EQUAL: return scanBlocks<Operator::GREATER_EQUAL>(cells, constant, rows, simd, out);
+        case Operator::CONTAINS: return;
+    }
+}
+
+// Selection bitmap of `column op constant` over the first `rows` row slots, nulls never match. nullopt for predicates
+// without a kernel, string columns only compare dictionary codes so they support = and != only. The constant has to
+// be of the column type, converting it could truncate or wrap and change the result, filters reject such constants.
+static optional<Bitmap> scanColumn(const Column &column, Operator op, const Value &constant, size_t rows, bool simd = hasAvx2) {
+    if (constant.isNull() or op == Operator::CONTAINS or constant.getType() != column.getType()) return nullopt;
+    Bitmap selection(rows);
+    auto &out = selection.data();
+    switch (column.getType()) {
+        case DataType::INT:
+            scanBlocks(column.values<int32_t>(), op, constant.as<int32_t>(), rows, simd, out);
+            break;
+        case DataType::LONG_LONG_INT:
+            scanBlocks(column.values<int64_t>(), op, constant.as<int64_t>(), rows, simd, out);
+            break;
+        case DataType::FLOAT:
+            scanBlocks(column.values<float>(), op, constant.as<float>(), rows, simd, out);
+            break;
+        case DataType::DOUBLE:
+            scanBlocks(column.values<double>(), op, constant.as<double>(), rows, simd, out);
+            break;
+        case DataType::STRING: {
+            if (op != Operator::EQUAL and op != Operator::NOT_EQUAL) return nullopt;
+            auto code = column.dict().find(constant.get_string());
+            if (!code) {
+                // Absent from the dictionary, nothing is equal and every non null cell differs.
+                if (op == Operator::NOT_EQUAL) {
+                    selection = Bitmap(rows, true);
+                    column.maskNulls(out, rows);
+                }
+                return selection;
+            }
+            scanBlocks(column.values<uint32_t>(), op, *code, rows, simd, out);
+            break;
+        }
+    }
+    column.maskNulls(out, rows);
+    return selection;
+}
+
+// Runs task(0) .. task(count - 1) on up to `threads` threads.
+static void parallel(size_t count, int threads, const function<void(size_t)> &task) {
+    atomic<size_t> next = 0;
+    auto work = [&] {
+        for(size_t i; (i = next++) < count; ) task(i);
+    };
+    vector<thread> workers;
+    for(int i = 1; i < threads and (size_t)i < count; i++) workers.emplace_back(work);
+    work();
+    for(auto &worker: workers) worker.join();
+}
+
+// Calls f with a zero of the type a column stores, dictionary codes for strings.
+template<typename F>
+static void withStorageType(DataType type, F f) {
+    switch (type) {
+        case DataType::INT: f(int32_t()); break;
+        case DataType::LONG_LONG_INT: f(int64_t()); break;
+        case DataType::DOUBLE: f(double()); break;
+        case DataType::FLOAT: f(float()); break;
+        case DataType::STRING: f(uint32_t()); break;
+    }
+}
+
+// A whole file mapped read only.
+class MappedFile {
+    const char *bytes = nullptr;
+    size_t length = 0;
+    public:
+    explicit MappedFile(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Cannot open " + path);
+        struct stat info;
+        if (fstat(fd, &info) == 0) length = info.st_size;
+        if (length) {
+            void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                bytes = (const char*)mapped;
+                madvise(mapped, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        if (length and !bytes) throw runtime_error("Cannot map " + path);
+    }
+
+    ~MappedFile() {
+        if (bytes) munmap((void*)bytes, length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    const char *data() const {return bytes;}
+    size_t size() const {return length;}
+};
+
+// Fields of one CSV record. Quoted fields may hold commas and doubled quotes, but not line breaks.
+static vector<string> csvFields(string_view line) {
+    vector<string> fields(1);
+    bool quoted = false;
+    for(size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c != '"') fields.back() += c;
+            else if (i + 1 < line.size() and line[i + 1] == '"') fields.back() += line[++i];
+            else quoted = false;
+        }
+        else if (c == '"') quoted = true;
+        else if (c == ',') fields.emplace_back();
+        else fields.back() += c;
+    }
+    return fields;
+}
+
+// Binary table file: this header, the column types, the (column, index type) pairs, then one chunk per column of
+// validity words and cells in storage form. String chunks end with their dictionary as string end offsets and bytes.
+// Every section starts 8 byte aligned, so a load maps the file and copies chunks into column blocks as they are.
+struct TableFileHeader {
+    static constexpr char MAGIC[8] = {'I', 'M', 'D', 'B', 'T', 'B', 'L', '1'};
+    char magic[8];
+    uint32_t columns;
+    uint32_t primaryKey;
+    uint64_t rows;
+    uint32_t indexes;
+    uint32_t reserved;
+};
+
+class BaseFilter;
+class Cursor;
+struct QueryPlan;
+class Table;
+
+// Commit timestamp after every snapshot: the end of a current version and the begin of a collected slot.
+constexpr int64_t INFINITE_TIMESTAMP = INT64_MAX;
+
+// A consistent read view, registered with its table while alive so garbage collection keeps what it can see.
+class Snapshot {
+    const Table &table;
+    int64_t ts;
+    int rowSlots;
+    public:
+    Snapshot(const Table &table, int64_t ts, int rowSlots): table(table), ts(ts), rowSlots(rowSlots) {}
+    ~Snapshot();
+    int64_t timestamp() const {return ts;}
+    // Row slots that existed when the snapshot was taken, later slots are never visible to it.
+    int rows() const {return rowSlots;}
+};
+
+enum class AggregateFunction {
+    COUNT,
+    SUM,
+    AVG,
+    MIN,
+    MAX
+};
+
+// One aggregate of a query, COUNT over column -1 counts rows, over a column it counts non null cells.
+struct Aggregate {
+    AggregateFunction function;
+    int column;
+
+    string describe() const {
+        static const char *names[] = {"COUNT", "SUM", "AVG", "MIN", "MAX"};
+        return string(names[(int)function]) + "(" + (column < 0 ? "*" : "column " + to_string(column)) + ")";
+    }
+};
+
+// Rows of an aggregation: the group columns then one column per aggregate, sorted by the group columns.
+// COUNT is LONG_LONG_INT, SUM of integers LONG_LONG_INT and of floating point DOUBLE, AVG DOUBLE, MIN and MAX the
+// column type. An aggregate over no non null cell is null, except COUNT.
+struct ResultSet {
+    vector<string> names;
+    vector<DataType> types;
+    vector<vector<Value>> rows;
+
+    void print() const {
+        for(size_t i = 0; i < names.size(); i++) cout << (i ? " | " : "") << names[i];
+        cout << endl;
+        for(auto &row: rows) {
+            for(size_t i = 0; i < row.size(); i++) cout << (i ? " | " : "") << (row[i].isNull() ? "null" : row[i].get_string());
+            cout << endl;
+        }
+    }
+};
+
+// Columnar table, a row id is the position of one row version in every column.
+// Update appends a new version and closes the old one, remove closes the current version. A version is visible to a
+// snapshot at ts when begin <= ts < end. Writers are serialized and publish a commit by advancing the clock, readers
+// scan without locks. Indexes keep every version until it is collected and are only locked around lookups.
+class Table {
+    static constexpr size_t COLLECT_BATCH = 1024;
+    shared_ptr<Schema> schema;
+    vector<unique_ptr<Column>> columns;
+    BlockVector<int64_t> begins;
+    BlockVector<int64_t> ends;
+    // Older version of the same key, -1 for the first.
+    BlockVector<int32_t> previous;
+    // Stable id of the row a version belongs to, and the newest slot of each row id.
+    BlockVector<int32_t> rowIds;
+    BlockVector<int32_t> locations;
+    // Newest version of a key, kept after remove until that version is collected.
+    unordered_map<Value, int, Hash> primaryIndex;
+    vector<unique_ptr<SecondaryIndex>> indexes;
+    // Closed versions in commit order, waiting for the oldest snapshot to move past them.
+    deque<int> retired;
+    // Writer side bookkeeping: current versions, collected slots to reuse lowest first, ids of collected rows.
+    Bitmap live;
+    set<int> freeSlots;
+    vector<int> freeIds;
+    atomic<int> numOfRows;
+    atomic<int> liveRows;
+    atomic<int64_t> clock;
+    mutex writeMutex;
+    mutable shared_mutex indexMutex;
+    mutable mutex snapshotMutex;
+    mutable multiset<int64_t> snapshots;
+    mutable multiset<int> snapshotRows;
+    thread compactor;
+    mutex compactorMutex;
+    condition_variable compactorWake;
+    bool stopping = false;
+
+    // Writes a new version into the lowest free slot, or a new slot at the end. The begin timestamp goes last,
+    // until then a reused slot stays invisible to every snapshot.
+    int append(const vector<Value> &values, int64_t ts, int older, int rowId) {
+        int row;
+        if (!freeSlots.empty()) {
+            row = *freeSlots.begin();
+            freeSlots.erase(freeSlots.begin());
+            for(size_t i = 0; i < columns.size(); i++) columns[i]->set(row, values[i]);
+            previous[row] = older;
+            __atomic_store_n(&rowIds[row], rowId, __ATOMIC_RELAXED);
+            __atomic_store_n(&ends[row], INFINITE_TIMESTAMP, __ATOMIC_RELEASE);
+            __atomic_store_n(&begins[row], ts, __ATOMIC_RELEASE);
+            live.set(row);
+        } else {
+            for(size_t i = 0; i < columns.size(); i++) columns[i]->append(values[i]);
+            begins.push_back(ts);
+            ends.push_back(INFINITE_TIMESTAMP);
+            previous.push_back(older);
+            rowIds.push_back(rowId);
+            row = numOfRows.load(memory_order_relaxed);
+            live.push_back(true);
+            numOfRows.store(row + 1, memory_order_release);
+        }
+        __atomic_store_n(&locations[rowId], row, __ATOMIC_RELEASE);
+        return row;
+    }
+
+    void close(int row, int64_t ts) {
+        __atomic_store_n(&ends[row], ts, __ATOMIC_RELEASE);
+        live.set(row, false);
+        retired.push_back(row);
+    }
+
+    bool current(int row) const {
+        return __atomic_load_n(&ends[row], __ATOMIC_ACQUIRE) == INFINITE_TIMESTAMP;
+    }
+
+    int newRowId() {
+        if (freeIds.empty()) {
+            locations.push_back(-1);
+            return locations.size() - 1;
+        }
+        int id = freeIds.back();
+        freeIds.pop_back();
+        return id;
+    }
+
+    void commit(int64_t ts) {
+        clock.store(ts, memory_order_release);
+        if (retired.size() >= COLLECT_BATCH) collect();
+    }
+
+    // Drops versions closed before the oldest snapshot from every index and frees their slots. Needs writeMutex.
+    void collect() {
+        int64_t oldest;
+        {
+            lock_guard guard(snapshotMutex);
+            oldest = snapshots.empty() ? clock.load() : *snapshots.begin();
+        }
+        unique_lock guard(indexMutex);
+        while (!retired.empty() and ends[retired.front()] <= oldest) {
+            int row = retired.front();
+            retired.pop_front();
+            for(auto &secondary: indexes) secondary->remove(columns[secondary->column()]->get(row), row);
+            auto it = primaryIndex.find(columns[schema->getPrimaryKeyIndex()]->get(row));
+            if (it != primaryIndex.end() and it->second == row) primaryIndex.erase(it);
+            if (locations[rowIds[row]] == row) {
+                // Last version of a removed row, its id can go to a new row. The key may already belong to a
+                // row inserted after the removal, under another id.
+                __atomic_store_n(&locations[rowIds[row]], -1, __ATOMIC_RELEASE);
+                freeIds.push_back(rowIds[row]);
+            }
+            __atomic_store_n(&begins[row], INFINITE_TIMESTAMP, __ATOMIC_RELEASE);
+            freeSlots.insert(row);
+        }
+    }
+
+    // Copies the current version in slot `from` to the lowest free slot as a new version of the same row,
+    // snapshots older than the move keep reading `from` until it is collected.
+    void move(int from) {
+        int64_t ts = clock.load(memory_order_relaxed) + 1;
+        auto values = getRow(from);
+        int row = append(values, ts, from, rowIds[from]);
+        {
+            unique_lock indexGuard(indexMutex);
+            for(auto &secondary: indexes) secondary->add(values[secondary->column()], row);
+            primaryIndex[values[schema->getPrimaryKeyIndex()]] = row;
+        }
+        close(from, ts);
+        commit(ts);
+    }
+
+    // Releases free slots at the end, but never below what an active snapshot may still scan. The new size is
+    // published under snapshotMutex before any block is freed, so a snapshot taken meanwhile never covers them.
+    void shrink() {
+        int rows = numOfRows.load(memory_order_relaxed);
+        int keep = rows;
+        while (keep > 0 and freeSlots.count(keep - 1)) keep--;
+        {
+            lock_guard guard(snapshotMutex);
+            if (!snapshotRows.empty()) keep = max(keep, *snapshotRows.rbegin());
+            if (keep >= rows) return;
+            numOfRows.store(keep, memory_order_release);
+        }
+        unique_lock guard(indexMutex);
+        for(auto &column: columns) column->truncate(keep);
+        begins.truncate(keep);
+        ends.truncate(keep);
+        previous.truncate(keep);
+        rowIds.truncate(keep);
+        live.resize(keep);
+        freeSlots.erase(freeSlots.lower_bound(keep), freeSlots.end());
+    }
+
+    void requireEmpty() const {
+        if (size() != 0 or locations.size() != 0) throw logic_error("Bulk loads need an empty table");
+    }
+
+    // Makes the bulk loaded rows [0, rows) one committed version each, all under the first timestamp.
+    void publishLoaded(int rows) {
+        for(int row = 0; row < rows; row++) {
+            begins.push_back(1);
+            ends.push_back(INFINITE_TIMESTAMP);
+            previous.push_back(-1);
+            rowIds.push_back(row);
+            locations.push_back(row);
+        }
+        live = Bitmap(rows, true);
+        liveRows = rows;
+        numOfRows.store(rows, memory_order_release);
+        clock.store(1, memory_order_release);
+    }
+
+    public:
+    Table(shared_ptr<Schema> schema):schema(std::move(schema)), numOfRows(0), liveRows(0), clock(0) {
+        for(auto type: this->schema->getTypes()) columns.push_back(make_unique<Column>(type));
+        for(auto [column, type]: this->schema->getSecondaryIndexes()) {
+            switch (type) {
+                case SecondaryIndexTypes::HASH: indexes.push_back(make_unique<HashIndex>(column)); break;
+                case SecondaryIndexTypes::SORTED: indexes.push_back(make_unique<SortedIndex>(column)); break;
+                case SecondaryIndexTypes::INVERTED: indexes.push_back(make_unique<InvertedIndex>(column)); break;
+            }
+        }
+    }
+
+    ~Table() {
+        stopCompaction();
+    }
+
+    pair<int, string> insert(vector<Value> &values) {
+        if (auto error = schema->error(values)) {
+            return {-1, *error};
+        }
+        const auto &key = values[schema->getPrimaryKeyIndex()];
+        lock_guard guard(writeMutex);
+        auto it = primaryIndex.find(key);
+        if (it != primaryIndex.end() and current(it->second)) {
+            return {-1, "Duplicate primary key"};
+        }
+        int64_t ts = clock.load(memory_order_relaxed) + 1;
+        int index = append(values, ts, it == primaryIndex.end() ? -1 : it->second, newRowId());
+        {
+            unique_lock indexGuard(indexMutex);
+            for(auto &secondary: indexes) secondary->add(values[secondary->column()], index);
+            primaryIndex[key] = index;
+        }
+        liveRows++;
+        commit(ts);
+        return {0, "Inserted succesfully"};
+    }
+
+    struct BatchResult {
+        int inserted = 0;
+        // Position of a rejected row in the batch and why it was rejected.
+        vector<pair<int, string>> errors;
+    };
+
+    // Validates the batch in one pass of the compiled constraints and commits every valid row under one timestamp,
+    // so a snapshot sees either none or all of them.
+    BatchResult insertBatch(const vector<vector<Value>> &rows) {
+        BatchResult result;
+        auto errors = schema->validateBatch(rows);
+        int pk = schema->getPrimaryKeyIndex();
+        lock_guard guard(writeMutex);
+        int64_t ts = clock.load(memory_order_relaxed) + 1;
+        {
+            unique_lock indexGuard(indexMutex);
+            for(size_t i = 0; i < rows.size(); i++) {
+                if (!errors[i].empty()) {
+                    result.errors.emplace_back(i, std::move(errors[i]));
+                    continue;
+                }
+                auto it = primaryIndex.find(rows[i][pk]);
+                if (it != primaryIndex.end() and current(it->second)) {
+                    result.errors.emplace_back(i, "Duplicate primary key");
+                    continue;
+                }
+                int index = append(rows[i], ts, it == primaryIndex.end() ? -1 : it->second, newRowId());
+                for(auto &secondary: indexes) secondary->add(rows[i][secondary->column()], index);
+                primaryIndex[rows[i][pk]] = index;
+                result.inserted++;
+            }
+        }
+        liveRows += result.inserted;
+        commit(ts);
+        return result;
+    }
+
+    bool remove(const Value& value) {
+        // Assuming the value is primary key
+        lock_guard guard(writeMutex);
+        auto it = primaryIndex.find(value);
+        if (it == primaryIndex.end() or !current(it->second)) return false;
+        int64_t ts = clock.load(memory_order_relaxed) + 1;
+        close(it->second, ts);
+        liveRows--;
+        commit(ts);
+        return true;
+    }
+
+    bool update(vector<Value> &values) {
+        const auto &value = values[schema->getPrimaryKeyIndex()];
+        if (!schema->validate(values)) return false;
+        lock_guard guard(writeMutex);
+        auto it = primaryIndex.find(value);
+        if (it == primaryIndex.end() or !current(it->second)) return false;
+        int old = it->second;
+        int64_t ts = clock.load(memory_order_relaxed) + 1;
+        int index = append(values, ts, old, rowIds[old]);
+        {
+            unique_lock indexGuard(indexMutex);
+            for(auto &secondary: indexes) secondary->add(values[secondary->column()], index);
+            it->second = index;
+        }
+        close(old, ts);
+        commit(ts);
+        return true;
+    }
+
+    void collectGarbage() {
+        lock_guard guard(writeMutex);
+        collect();
+    }
+
+    // One bounded compaction step: collect, move the highest live rows into the lowest free slots until the budget
+    // runs out, then release the free tail. Returns whether there is work left for another step.
+    bool compact(chrono::microseconds budget) {
+        auto deadline = chrono::steady_clock::now() + budget;
+        lock_guard guard(writeMutex);
+        collect();
+        long last = live.prevSet(live.size() - 1);
+        while (!freeSlots.empty() and last > *freeSlots.begin() and chrono::steady_clock::now() < deadline) {
+            move(last);
+            last = live.prevSet(last - 1);
+        }
+        shrink();
+        return !retired.empty() or (!freeSlots.empty() and live.prevSet(live.size() - 1) > *freeSlots.begin());
+    }
+
+    // Runs compaction steps of at most `budget` every `interval` on a background thread.
+    void startCompaction(chrono::milliseconds interval, chrono::microseconds budget) {
+        stopCompaction();
+        stopping = false;
+        compactor = thread([this, interval, budget] {
+            unique_lock guard(compactorMutex);
+            while (!compactorWake.wait_for(guard, interval, [this] { return stopping; })) {
+                guard.unlock();
+                compact(budget);
+                guard.lock();
+            }
+        });
+    }
+
+    void stopCompaction() {
+        {
+            lock_guard guard(compactorMutex);
+            stopping = true;
+        }
+        compactorWake.notify_all();
+        if (compactor.joinable()) compactor.join();
+    }
+
+    // Writes the rows visible now to a binary table file, see TableFileHeader. Readers and writers carry on meanwhile,
+    // and the file only replaces `path` once it is complete.
+    void save(const string &path) const {
+        auto view = snapshot();
+        Bitmap visibleRows = visible(*view);
+        vector<int> rows;
+        for(size_t row = visibleRows.nextSet(0); row < visibleRows.size(); row = visibleRows.nextSet(row + 1)) rows.push_back(row);
+        string partial = path + ".tmp";
+        ofstream out(partial, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("Cannot write " + partial);
+        auto write = [&](const void *data, size_t bytes) {
+            static const char padding[8] = {};
+            out.write((const char*)data, bytes);
+            out.write(padding, (8 - bytes % 8) % 8);
+        };
+
+        TableFileHeader header = {};
+        memcpy(header.magic, TableFileHeader::MAGIC, sizeof header.magic);
+        header.columns = columns.size();
+        header.primaryKey = schema->getPrimaryKeyIndex();
+        header.rows = rows.size();
+        header.indexes = schema->getSecondaryIndexes().size();
+        write(&header, sizeof header);
+        vector<uint32_t> types, indexList;
+        for(auto type: schema->getTypes()) types.push_back((uint32_t)type);
+        for(auto [column, type]: schema->getSecondaryIndexes()) indexList.insert(indexList.end(), {(uint32_t)column, (uint32_t)type});
+        write(types.data(), types.size() * sizeof(uint32_t));
+        write(indexList.data(), indexList.size() * sizeof(uint32_t));
+
+        for(auto &column: columns) {
+            vector<uint64_t> validity((rows.size() + 63) / 64);
+            for(size_t i = 0; i < rows.size(); i++) {
+                if (!column->isNull(rows[i])) validity[i >> 6] |= 1ULL << (i & 63);
+            }
+            write(validity.data(), validity.size() * sizeof(uint64_t));
+            withStorageType(column->getType(), [&](auto zero) {
+                using T = decltype(zero);
+                auto &cells = column->values<T>();
+                vector<T> packed(rows.size());
+                for(size_t i = 0; i < rows.size(); i++) packed[i] = cells[rows[i]];
+                write(packed.data(), packed.size() * sizeof(T));
+            });
+            if (column->getType() != DataType::STRING) continue;
+            // Read after the codes, so every code written has its string.
+            auto &dictionary = column->dict();
+            uint64_t strings = dictionary.size();
+            vector<uint64_t> stringEnds;
+            string bytes;
+            for(uint64_t code = 0; code < strings; code++) {
+                bytes += dictionary.decode(code);
+                stringEnds.push_back(bytes.size());
+            }
+            write(&strings, sizeof strings);
+            write(stringEnds.data(), stringEnds.size() * sizeof(uint64_t));
+            write(bytes.data(), bytes.size());
+        }
+        out.close();
+        if (!out) throw runtime_error("Cannot write " + partial);
+        filesystem::rename(partial, path);
+    }
+
+    // Fills an empty table from a file written by save. The primary index is built first from the mapped key column,
+    // so a file with a repeated key is rejected before anything is copied. Then each column chunk is copied into column
+    // blocks as it is, one task per column, and every secondary index is built by its own task.
+    void load(const string &path, int threads = thread::hardware_concurrency()) {
+        lock_guard guard(writeMutex);
+        requireEmpty();
+        MappedFile file(path);
+        size_t offset = 0;
+        auto take = [&](uint64_t bytes) {
+            if (bytes > file.size() - offset) throw runtime_error("Truncated table file " + path);
+            const char *at = file.data() + offset;
+            offset = min(file.size(), offset + (bytes + 7) / 8 * 8);
+            return at;
+        };
+        auto mismatch = [&] {
+            return runtime_error(path + " does not match the table schema");
+        };
+
+        TableFileHeader header;
+        memcpy(&header, take(sizeof header), sizeof header);
+        if (memcmp(header.magic, TableFileHeader::MAGIC, sizeof header.magic) != 0) throw runtime_error(path + " is not a table file");
+        auto &schemaIndexes = schema->getSecondaryIndexes();
+        if (header.columns != columns.size() or header.primaryKey != (uint32_t)schema->getPrimaryKeyIndex() or
+            header.indexes != schemaIndexes.size()) throw mismatch();
+        if (header.rows > min<uint64_t>(INT_MAX, MAX_BLOCKS * BLOCK_ROWS)) throw runtime_error("Too many rows in " + path);
+        auto types = (const uint32_t*)take(header.columns * sizeof(uint32_t));
+        auto indexList = (const uint32_t*)take(header.indexes * 2 * sizeof(uint32_t));
+        for(size_t c = 0; c < columns.size(); c++) {
+            if (types[c] != (uint32_t)columns[c]->getType()) throw mismatch();
+        }
+        for(size_t i = 0; i < schemaIndexes.size(); i++) {
+            if (indexList[2 * i] != (uint32_t)schemaIndexes[i].first or indexList[2 * i + 1] != (uint32_t)schemaIndexes[i].second) throw mismatch();
+        }
+
+        struct Chunk {
+            const uint64_t *validity;
+            const char *cells;
+            uint64_t strings = 0;
+            const uint64_t *stringEnds = nullptr;
+            const char *bytes = nullptr;
+        };
+        int rows = header.rows;
+        vector<Chunk> chunks(columns.size());
+        for(size_t c = 0; c < columns.size(); c++) {
+            auto &chunk = chunks[c];
+            chunk.validity = (const uint64_t*)take((rows + 63) / 64 * sizeof(uint64_t));
+            withStorageType(columns[c]->getType(), [&](auto zero) {
+                chunk.cells = take(rows * sizeof(zero));
+            });
+            if (columns[c]->getType() != DataType::STRING) continue;
+            memcpy(&chunk.strings, take(sizeof chunk.strings), sizeof chunk.strings);
+            if (chunk.strings > file.size()) throw runtime_error("Truncated table file " + path);
+            chunk.stringEnds = (const uint64_t*)take(chunk.strings * sizeof(uint64_t));
+            for(uint64_t i = 1; i < chunk.strings; i++) {
+                if (chunk.stringEnds[i] < chunk.stringEnds[i - 1]) throw runtime_error("Corrupt dictionary in " + path);
+            }
+            chunk.bytes = take(chunk.strings ? chunk.stringEnds[chunk.strings - 1] : 0);
+            auto codes = (const uint32_t*)chunk.cells;
+            for(int row = 0; row < rows; row++) {
+                if (codes[row] >= max<uint64_t>(chunk.strings, 1)) throw runtime_error("Corrupt dictionary in " + path);
+            }
+        }
+
+        {
+            unique_lock indexGuard(indexMutex);
+            int pk = schema->getPrimaryKeyIndex();
+            auto &chunk = chunks[pk];
+            primaryIndex.reserve(rows);
+            withStorageType(columns[pk]->getType(), [&](auto zero) {
+                auto cells = (const decltype(zero)*)chunk.cells;
+                for(int row = 0; row < rows; row++) {
+                    Value key = Value::null(columns[pk]->getType());
+                    if (chunk.validity[row >> 6] >> (row & 63) & 1) {
+                        if constexpr (is_same_v<decltype(zero), uint32_t>) {
+                            if (cells[row] >= chunk.strings) {
+                                primaryIndex.clear();
+                                throw runtime_error("Corrupt dictionary in " + path);
+                            }
+                            uint64_t from = cells[row] ? chunk.stringEnds[cells[row] - 1] : 0;
+                            key = Value(string(chunk.bytes + from, chunk.bytes + chunk.stringEnds[cells[row]]), DataType::STRING);
+                        } else key = Value(cells[row]);
+                    }
+                    if (!primaryIndex.try_emplace(std::move(key), row).second) {
+                        primaryIndex.clear();
+                        throw runtime_error("Duplicate primary key in " + path);
+                    }
+                }
+            });
+        }
+
+        threads = max(1, threads);
+        parallel(columns.size(), threads, [&](size_t c) {
+            auto &chunk = chunks[c];
+            auto &column = *columns[c];
+            uint64_t from = 0;
+            for(uint64_t i = 0; i < chunk.strings; i++) {
+                column.dict().encode(string(chunk.bytes + from, chunk.bytes + chunk.stringEnds[i]));
+                from = chunk.stringEnds[i];
+            }
+            withStorageType(column.getType(), [&](auto zero) {
+                column.appendRaw((const decltype(zero)*)chunk.cells, chunk.validity, rows);
+            });
+        });
+        {
+            unique_lock indexGuard(indexMutex);
+            parallel(indexes.size(), threads, [&](size_t i) {
+                auto &secondary = *indexes[i];
+                auto &column = *columns[secondary.column()];
+                vector<pair<Value, int>> entries;
+                entries.reserve(rows);
+                for(int row = 0; row < rows; row++) entries.emplace_back(column.get(row), row);
+                secondary.addAll(std::move(entries));
+            });
+        }
+        publishLoaded(rows);
+    }
+
+    // Fills an empty table from a CSV file. The file is mapped and split at line boundaries, one part per thread, and
+    // every part is parsed and validated in batches. Then each column and each secondary index is built by its own
+    // task from the parsed rows. Rejected rows are reported by their position among the data rows.
+    BatchResult importCsv(const string &path, int threads = thread::hardware_concurrency(), bool header = true) {
+        constexpr size_t BATCH = 4096;
+        lock_guard guard(writeMutex);
+        requireEmpty();
+        threads = max(1, threads);
+        MappedFile file(path);
+        string_view text(file.data(), file.size());
+        size_t start = 0;
+        if (header) start = text.find('\n') == string_view::npos ? text.size() : text.find('\n') + 1;
+        vector<size_t> bounds = {start};
+        for(int i = 1; i < threads; i++) {
+            size_t at = start + (text.size() - start) * i / threads;
+            if (at > bounds.back()) {
+                // The line holding the byte before `at` stays with the previous part.
+                size_t newline = text.find('\n', at - 1);
+                at = newline == string_view::npos ? text.size() : newline + 1;
+            }
+            bounds.push_back(max(at, bounds.back()));
+        }
+        bounds.push_back(text.size());
+
+        struct Part {
+            vector<vector<Value>> rows;
+            // Position of each parsed row among the records of the part.
+            vector<int> positions;
+            vector<pair<int, string>> errors;
+            int records = 0;
+        };
+        vector<Part> parts(threads);
+        auto &types = schema->getTypes();
+        parallel(threads, threads, [&](size_t p) {
+            auto &part = parts[p];
+            vector<vector<Value>> batch;
+            vector<int> positions;
+            auto validate = [&] {
+                auto errors = schema->validateBatch(batch);
+                for(size_t i = 0; i < batch.size(); i++) {
+                    if (!errors[i].empty()) part.errors.emplace_back(positions[i], std::move(errors[i]));
+                    else {
+                        part.rows.push_back(std::move(batch[i]));
+                        part.positions.push_back(positions[i]);
+                    }
+                }
+                batch.clear();
+                positions.clear();
+            };
+            for(size_t at = bounds[p]; at < bounds[p + 1]; ) {
+                size_t end = min(text.find('\n', at), bounds[p + 1]);
+                auto line = text.substr(at, end - at);
+                at = end + 1;
+                if (!line.empty() and line.back() == '\r') line.remove_suffix(1);
+                if (line.empty()) continue;
+                int position = part.records++;
+                auto fields = csvFields(line);
+                if (fields.size() != types.size()) {
+                    part.errors.emplace_back(position, "Wrong number of fields");
+                    continue;
+                }
+                vector<Value> values;
+                values.reserve(fields.size());
+                string error;
+                for(size_t i = 0; i < fields.size(); i++) {
+                    bool empty = fields[i].empty();
+                    values.emplace_back(std::move(fields[i]), types[i]);
+                    // Only an empty field is null, anything else has to parse as the column type.
+                    if (!empty and values.back().isNull() and error.empty()) error = "column " + to_string(i) + " does not parse";
+                }
+                if (!error.empty()) {
+                    part.errors.emplace_back(position, std::move(error));
+                    continue;
+                }
+                batch.push_back(std::move(values));
+                positions.push_back(position);
+                if (batch.size() == BATCH) validate();
+            }
+            if (!batch.empty()) validate();
+        });
+
+        size_t parsed = 0;
+        for(auto &part: parts) parsed += part.rows.size();
+        if (parsed > MAX_BLOCKS * BLOCK_ROWS) throw length_error("Too many rows in " + path);
+
+        BatchResult result;
+        unique_lock indexGuard(indexMutex);
+        // Keys in file order, a repeated key is rejected like a duplicate insert.
+        int pk = schema->getPrimaryKeyIndex(), records = 0, rows = 0;
+        vector<int> firstRow;
+        for(auto &part: parts) {
+            for(auto &[position, error]: part.errors) result.errors.emplace_back(records + position, std::move(error));
+            firstRow.push_back(rows);
+            size_t kept = 0;
+            for(size_t i = 0; i < part.rows.size(); i++) {
+                if (!primaryIndex.try_emplace(part.rows[i][pk], rows).second) {
+                    result.errors.emplace_back(records + part.positions[i], "Duplicate primary key");
+                    continue;
+                }
+                if (kept != i) part.rows[kept] = std::move(part.rows[i]);
+                kept++;
+                rows++;
+            }
+            part.rows.resize(kept);
+            records += part.records;
+        }
+        sort(result.errors.begin(), result.errors.end());
+
+        parallel(columns.size() + indexes.size(), threads, [&](size_t task) {
+            if (task < columns.size()) {
+                for(auto &part: parts) {
+                    for(auto &values: part.rows) columns[task]->append(values[task]);
+                }
+                return;
+            }
+            auto &secondary = *indexes[task - columns.size()];
+            vector<pair<Value, int>> entries;
+            entries.reserve(rows);
+            for(size_t p = 0; p < parts.size(); p++) {
+                int row = firstRow[p];
+                for(auto &values: parts[p].rows) entries.emplace_back(values[secondary.column()], row++);
+            }
+            secondary.addAll(std::move(entries));
+        });
+        publishLoaded(rows);
+        result.inserted = rows;
+        return result;
+    }
+
+    shared_ptr<const Snapshot> snapshot() const {
+        lock_guard guard(snapshotMutex);
+        int64_t ts = clock.load(memory_order_acquire);
+        int rows = numOfRows.load(memory_order_acquire);
+        snapshots.insert(ts);
+        snapshotRows.insert(rows);
+        return make_shared<const Snapshot>(*this, ts, rows);
+    }
+
+    void release(int64_t ts, int rows) const {
+        lock_guard guard(snapshotMutex);
+        snapshots.erase(snapshots.find(ts));
+        snapshotRows.erase(snapshotRows.find(rows));
+    }
+
+    // Versions visible to the snapshot, two vectorized compares over the timestamp columns. Ends are read before
+    // begins: a slot collected and reused meanwhile then shows the reused end with the new, later begin.
+    Bitmap visible(const Snapshot &snapshot) const {
+        Bitmap rows(snapshot.rows()), open(snapshot.rows());
+        scanBlocks(ends, Operator::GREATER, snapshot.timestamp(), snapshot.rows(), hasAvx2, open.data());
+        atomic_thread_fence(memory_order_acquire);
+        scanBlocks(begins, Operator::LESS_EQUAL, snapshot.timestamp(), snapshot.rows(), hasAvx2, rows.data());
+        rows.andWith(open);
+        return rows;
+    }
+
+    bool isVisible(int row, const Snapshot &snapshot) const {
+        if (snapshot.timestamp() >= __atomic_load_n(&ends[row], __ATOMIC_ACQUIRE)) return false;
+        return __atomic_load_n(&begins[row], __ATOMIC_ACQUIRE) <= snapshot.timestamp();
+    }
+
+    vector<Value> getRow(int row) const {
+        vector<Value> values;
+        for(auto &column: columns) values.push_back(column->get(row));
+        return values;
+    }
+
+    // Row id of the version in a slot. Row ids survive updates and compaction, a slot does not.
+    int rowIdOf(int row) const {
+        return __atomic_load_n(&rowIds[row], __ATOMIC_RELAXED);
+    }
+
+    // Slot of the newest version of a row id, -1 once the row is removed and collected.
+    int slotOf(int rowId) const {
+        return __atomic_load_n(&locations[rowId], __ATOMIC_ACQUIRE);
+    }
+
+    const Column &column(int index) const {
+        return *columns[index];
+    }
+
+    // Every version of a key that is not collected yet, newest first. Callers hold readIndexes().
+    // A collected slot can be reused by a newer version while an older one still points at it, so the walk stops
+    // at the first link that does not go back in time.
+    vector<int> versions(const Value &key) const {
+        vector<int> rows;
+        auto it = primaryIndex.find(key);
+        int pk = schema->getPrimaryKeyIndex();
+        int64_t newer = INFINITE_TIMESTAMP;
+        for(int row = it == primaryIndex.end() ? -1 : it->second; row >= 0 and row < size(); row = previous[row]) {
+            int64_t begin = __atomic_load_n(&begins[row], __ATOMIC_ACQUIRE);
+            if (begin >= newer or !(columns[pk]->get(row) == key)) break;
+            rows.push_back(row);
+            newer = begin;
+        }
+        return rows;
+    }
+
+    int primaryKeyColumn() const {
+        return schema->getPrimaryKeyIndex();
+    }
+
+    const shared_ptr<Schema> &getSchema() const {
+        return schema;
+    }
+
+    shared_lock<shared_mutex> readIndexes() const {
+        return shared_lock(indexMutex);
+    }
+
+    // Index of the given type on a column, nullptr when there is none. Lookups go under readIndexes().
+    template<typename Index>
+    const Index *index(int column) const {
+        for(auto &secondary: indexes) {
+            if (secondary->column() != column) continue;
+            if (auto typed = dynamic_cast<const Index*>(secondary.get())) return typed;
+        }
+        return nullptr;
+    }
+
+    // Whether the row slot holds the current version of its key.
+    bool isLive(int row) const {
+        return current(row) and __atomic_load_n(&begins[row], __ATOMIC_ACQUIRE) != INFINITE_TIMESTAMP;
+    }
+
+    // Row slots including old versions and free slots, scans go up to this and check visibility.
+    int size() const {
+        return numOfRows.load(memory_order_acquire);
+    }
+
+    int count() const {
+        return liveRows;
+    }
+
+    // Row slots still holding a version some snapshot may read.
+    int versionCount() {
+        lock_guard guard(writeMutex);
+        return size() - freeSlots.size();
+    }
+
+    QueryPlan plan(const BaseFilter &filter) const;
+    // Visible rows the plan of the filter found, and the filters they still have to match.
+    pair<Bitmap, vector<const BaseFilter*>> candidates(const BaseFilter &filter, const Snapshot &snapshot) const;
+    Cursor search(shared_ptr<const BaseFilter> filter) const;
+    Cursor search(shared_ptr<const BaseFilter> filter, shared_ptr<const Snapshot> snapshot) const;
+    // Aggregates of the rows matching `filter`, every row when it is null, grouped by the given columns.
+    ResultSet aggregate(const vector<int> &groupBy, const vector<Aggregate> &aggregates, shared_ptr<const BaseFilter> filter = nullptr,
+                        shared_ptr<const Snapshot> snapshot = nullptr, int threads = thread::hardware_concurrency()) const;
+    string explain(const BaseFilter &filter) const;
+
+    void printRows() {
+        auto view = snapshot();
+        Bitmap rows = visible(*view);
+        for(size_t row = rows.nextSet(0); row < rows.size(); row = rows.nextSet(row + 1)) {
+            for(auto &value: getRow(row)) cout << value.get_string() <<" ";
+            cout << endl; 
+        }
+    }
+};
+
+
+Snapshot::~Snapshot() {
+    table.release(ts, rowSlots);
+}
+
+
+class FieldFilter;
+
+// A node of the chosen plan. INDEX answers one field filter from an index, INTERSECT and UNION combine
+// their children, SCAN visits every live row. Rows of a node are then checked against its residual filters.
+struct QueryPlan {
+    enum Kind {INDEX, INTERSECT, UNION, SCAN} kind;
+    const FieldFilter *lookup = nullptr;
+    const BaseFilter *scan = nullptr;
+    const char *index = "";
+    size_t estimate = 0;
+    vector<QueryPlan> children;
+    vector<const BaseFilter*> residual;
+
+    QueryPlan(Kind kind, const FieldFilter *lookup = nullptr): kind(kind), lookup(lookup) {}
+};
+
+class BaseFilter {
+    public:
+    virtual ~BaseFilter() = default;
+    virtual bool matches(const Table &table, int row) const = 0;
+    // Throws invalid_argument when the filter does not fit the table's columns, called before planning.
+    virtual void validate(const Table &table) const = 0;
+    // Plan using indexes only, nullopt when some part of the filter needs a scan.
+    virtual optional<QueryPlan> plan(const Table &table) const = 0;
+    // Selection bitmap over the first `rows` row slots, visibility is checked by the caller.
+    virtual Bitmap evaluate(const Table &table, int rows) const = 0;
+    // Whether evaluate runs on column kernels rather than row by row.
+    virtual bool vectorizable(const Table &table) const = 0;
+    virtual string describe() const = 0;
+};
+
+class FieldFilter: public BaseFilter {
+    int columnIndex;
+    Operator op;
+    Value value;
+    public:
+    FieldFilter(int column, Operator op, Value value): columnIndex(column), op(op), value(std::move(value)) {}
+
+    bool matches(const Table &table, int row) const override {
+        Value cell = table.column(columnIndex).get(row);
+        if (cell.isNull()) return false;
+        switch (op) {
+            case Operator::EQUAL: return cell == value;
+            case Operator::NOT_EQUAL: return !(cell == value);
+            case Operator::LESS: return cell < value;
+            case Operator::LESS_EQUAL: return !(value < cell);
+            case Operator::GREATER: return value < cell;
+            case Operator::GREATER_EQUAL: return !(cell < value);
+            case Operator::CONTAINS: {
+                auto tokens = InvertedIndex::tokenize(cell.get_string());
+                auto wanted = InvertedIndex::tokenize(value.get_string());
+                return !wanted.empty() and includes(tokens.begin(), tokens.end(), wanted.begin(), wanted.end());
+            }
+        }
+        return false;
+    }
+
+    // Cells only compare equal to values of their own type, so a constant of another type would silently match
+    // nothing and order by variant index in ranges and index lookups.
+    void validate(const Table &table) const override {
+        auto &types = table.getSchema()->getTypes();
+        if (columnIndex < 0 or columnIndex >= (int)types.size()) throw invalid_argument("No column " + to_string(columnIndex));
+        if (op == Operator::CONTAINS and types[columnIndex] != DataType::STRING) throw invalid_argument("CONTAINS on a non string column");
+        if (value.getType() != types[columnIndex]) throw invalid_argument("Constant of another type than column " + to_string(columnIndex));
+    }
+
+    optional<QueryPlan> plan(const Table &table) const override {
+        QueryPlan plan{QueryPlan::INDEX, this};
+        auto *hash = table.index<HashIndex>(columnIndex);
+        auto *sorted = table.index<SortedIndex>(columnIndex);
+        auto *inverted = table.index<InvertedIndex>(columnIndex);
+        if (op == Operator::EQUAL and columnIndex == table.primaryKeyColumn()) {
+            plan.index = "PRIMARY";
+            plan.estimate = table.versions(value).empty() ? 0 : 1;
+        }
+        else if (op == Operator::EQUAL and hash) {
+            plan.index = "HASH";
+            plan.estimate = hash->equal(value).size();
+        }
+        else if (op == Operator::CONTAINS and inverted) {
+            plan.index = "INVERTED";
+            plan.estimate = table.count();
+            for(auto &token: InvertedIndex::tokenize(value.get_string())) plan.estimate = min(plan.estimate, inverted->token(token).size());
+        }
+        else if (op != Operator::NOT_EQUAL and op != Operator::CONTAINS and sorted) {
+            auto [low, high] = bounds();
+            plan.index = "SORTED";
+            plan.estimate = sorted->estimate(low, high);
+        }
+        else return nullopt;
+        return plan;
+    }
+
+    Bitmap evaluate(const Table &table, int rows) const override {
+        if (auto selection = scanColumn(table.column(columnIndex), op, value, rows)) return std::move(*selection);
+        Bitmap selection(rows);
+        for(int row = 0; row < rows; row++) selection.set(row, matches(table, row));
+        return selection;
+    }
+
+    bool vectorizable(const Table &table) const override {
+        if (op == Operator::CONTAINS or value.isNull() or value.getType() != table.column(columnIndex).getType()) return false;
+        return table.column(columnIndex).getType() != DataType::STRING or op == Operator::EQUAL or op == Operator::NOT_EQUAL;
+    }
+
+    // Sorted row ids from the index picked by plan().
+    vector<int> lookup(const Table &table) const {
+        if (op == Operator::EQUAL and columnIndex == table.primaryKeyColumn()) {
+            auto rows = table.versions(value);
+            sort(rows.begin(), rows.end());
+            return rows;
+        }
+        if (op == Operator::EQUAL) {
+            if (auto *hash = table.index<HashIndex>(columnIndex)) return hash->equal(value);
+        }
+        if (op == Operator::CONTAINS) {
+            auto *inverted = table.index<InvertedIndex>(columnIndex);
+            auto tokens = InvertedIndex::tokenize(value.get_string());
+            if (tokens.empty()) return {};
+            vector<int> rows = inverted->token(tokens[0]);
+            for(size_t i = 1; i < tokens.size(); i++) {
+                auto &other = inverted->token(tokens[i]);
+                vector<int> both;
+                set_intersection(rows.begin(), rows.end(), other.begin(), other.end(), back_inserter(both));
+                rows.swap(both);
+            }
+            return rows;
+        }
+        auto [low, high] = bounds();
+        return table.index<SortedIndex>(columnIndex)->range(low, op != Operator::GREATER, high, op != Operator::LESS);
+    }
+
+    pair<optional<Value>, optional<Value>> bounds() const {
+        switch (op) {
+            case Operator::LESS: case Operator::LESS_EQUAL: return {nullopt, value};
+            case Operator::GREATER: case Operator::GREATER_EQUAL: return {value, nullopt};
+            default: return {value, value};
+        }
+    }
+
+    string describe() const override {
+        static const char *symbols[] = {"=", "!=", "<", "<=", ">", ">=", "CONTAINS"};
+        return "column " + to_string(columnIndex) + " " + symbols[(int)op] + " " + value.get_string();
+    }
+};
+
+class AndFilter: public BaseFilter {
+    vector<shared_ptr<const BaseFilter>> filters;
+    public:
+    AndFilter(vector<shared_ptr<const BaseFilter>> filters): filters(std::move(filters)) {}
+
+    bool matches(const Table &table, int row) const override {
+        for(auto &filter: filters) {
+            if (!filter->matches(table, row)) return false;
+        }
+        return true;
+    }
+
+    void validate(const Table &table) const override {
+        for(auto &filter: filters) filter->validate(table);
+    }
+
+    // The most selective index drives, other indexes join the intersection while they are selective
+    // enough to be cheaper than checking the candidate rows, everything else is checked per row.
+    optional<QueryPlan> plan(const Table &table) const override {
+        vector<pair<QueryPlan, const BaseFilter*>> indexed;
+        vector<const BaseFilter*> residual;
+        for(auto &filter: filters) {
+            auto plan = filter->plan(table);
+            if (plan) indexed.emplace_back(std::move(*plan), filter.get());
+            else residual.push_back(filter.get());
+        }
+        if (indexed.empty()) return nullopt;
+        sort(indexed.begin(), indexed.end(), [](auto &a, auto &b) { return a.first.estimate < b.first.estimate; });
+        QueryPlan plan{QueryPlan::INTERSECT};
+        plan.estimate = indexed[0].first.estimate;
+        for(size_t i = 0; i < indexed.size(); i++) {
+            if (i == 0 or indexed[i].first.estimate <= (size_t)table.count() / 16) plan.children.push_back(std::move(indexed[i].first));
+            else residual.push_back(indexed[i].second);
+        }
+        plan.residual = std::move(residual);
+        if (plan.children.size() == 1 and plan.residual.empty()) return std::move(plan.children[0]);
+        return plan;
+    }
+
+    // Kernels narrow the selection first, the other filters only look at what is left.
+    Bitmap evaluate(const Table &table, int rows) const override {
+        optional<Bitmap> selection;
+        vector<const BaseFilter*> rest;
+        for(auto &filter: filters) {
+            if (!filter->vectorizable(table)) rest.push_back(filter.get());
+            else if (!selection) selection = filter->evaluate(table, rows);
+            else selection->andWith(filter->evaluate(table, rows));
+        }
+        if (!selection) selection = Bitmap(rows, true);
+        for(size_t row = selection->nextSet(0); row < selection->size(); row = selection->nextSet(row + 1)) {
+            for(auto *check: rest) {
+                if (!check->matches(table, row)) {
+                    selection->set(row, false);
+                    break;
+                }
+            }
+        }
+        return std::move(*selection);
+    }
+
+    bool vectorizable(const Table &table) const override {
+        for(auto &filter: filters) {
+            if (filter->vectorizable(table)) return true;
+        }
+        return false;
+    }
+
+    string describe() const override {
+        string text;
+        for(auto &filter: filters) text += (text.empty() ? "(" : " AND ") + filter->describe();
+        return text + ")";
+    }
+};
+
+class OrFilter: public BaseFilter {
+    vector<shared_ptr<const BaseFilter>> filters;
+    public:
+    OrFilter(vector<shared_ptr<const BaseFilter>> filters): filters(std::move(filters)) {}
+
+    bool matches(const Table &table, int row) const override {
+        for(auto &filter: filters) {
+            if (filter->matches(table, row)) return true;
+        }
+        return false;
+    }
+
+    void validate(const Table &table) const override {
+        for(auto &filter: filters) filter->validate(table);
+    }
+
+    // Every branch has to come from an index, a single scanned branch means scanning anyway.
+    optional<QueryPlan> plan(const Table &table) const override {
+        QueryPlan plan{QueryPlan::UNION};
+        for(auto &filter: filters) {
+            auto child = filter->plan(table);
+            if (!child) return nullopt;
+            plan.estimate = min(plan.estimate + child->estimate, (size_t)table.count());
+            plan.children.push_back(std::move(*child));
+        }
+        return plan;
+    }
+
+    Bitmap evaluate(const Table &table, int rows) const override {
+        Bitmap selection(rows);
+        for(auto &filter: filters) selection.orWith(filter->evaluate(table, rows));
+        return selection;
+    }
+
+    bool vectorizable(const Table &table) const override {
+        for(auto &filter: filters) {
+            if (!filter->vectorizable(table)) return false;
+        }
+        return true;
+    }
+
+    string describe() const override {
+        string text;
+        for(auto &filter: filters) text += (text.empty() ? "(" : " OR ") + filter->describe();
+        return text + ")";
+    }
+};
+
+// Streams matching rows of a snapshot in row id order. Candidates come from the plan and the snapshot's
+// visible versions, residual filters are checked on the way. Holding the cursor keeps the snapshot readable.
+class Cursor {
+    const Table &table;
+    shared_ptr<const BaseFilter> filter;
+    shared_ptr<const Snapshot> snapshot;
+    Bitmap candidates;
+    vector<const BaseFilter*> residual;
+    size_t position;
+    int current;
+    public:
+    Cursor(const Table &table, shared_ptr<const BaseFilter> filter, shared_ptr<const Snapshot> snapshot, Bitmap candidates,
+           vector<const BaseFilter*> residual):
+    table(table), filter(std::move(filter)), snapshot(std::move(snapshot)), candidates(std::move(candidates)), residual(std::move(residual)),
+    position(0), current(-1) {}
+
+    bool next() {
+        while ((position = candidates.nextSet(position)) < candidates.size()) {
+            int row = position++;
+            bool matches = true;
+            for(auto *check: residual) {
+                if (!(matches = check->matches(table, row))) break;
+            }
+            if (matches) {
+                current = row;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Stable id of the current row, see Table::slotOf.
+    int rowId() const {
+        return table.rowIdOf(current);
+    }
+
+    int slot() const {
+        return current;
+    }
+
+    vector<Value> row() const {
+        return table.getRow(current);
+    }
+};
+
+// Candidate rows of a plan among the first `slots` row slots, before visibility.
+static Bitmap execute(const Table &table, const QueryPlan &plan, int slots, bool applyResidual) {
+    Bitmap rows(slots);
+    switch (plan.kind) {
+        case QueryPlan::INDEX: {
+            vector<int> found;
+            {
+                auto guard = table.readIndexes();
+                found = plan.lookup->lookup(table);
+            }
+            for(int row: found) {
+                if (row < slots) rows.set(row);
+            }
+            break;
+        }
+        case QueryPlan::INTERSECT:
+            rows = execute(table, plan.children[0], slots, true);
+            for(size_t i = 1; i < plan.children.size(); i++) rows.andWith(execute(table, plan.children[i], slots, true));
+            break;
+        case QueryPlan::UNION:
+            for(auto &child: plan.children) rows.orWith(execute(table, child, slots, true));
+            break;
+        case QueryPlan::SCAN:
+            rows = plan.scan->evaluate(table, slots);
+            break;
+    }
+    if (!applyResidual) return rows;
+    for(size_t row = rows.nextSet(0); row < rows.size(); row = rows.nextSet(row + 1)) {
+        for(auto *check: plan.residual) {
+            if (!check->matches(table, row)) {
+                rows.set(row, false);
+                break;
+            }
+        }
+    }
+    return rows;
+}
+
+QueryPlan Table::plan(const BaseFilter &filter) const {
+    filter.validate(*this);
+    auto plan = [&] {
+        auto guard = readIndexes();
+        return filter.plan(*this);
+    }();
+    if (plan) return std::move(*plan);
+    QueryPlan scan{QueryPlan::SCAN};
+    scan.estimate = count();
+    scan.scan = &filter;
+    return scan;
+}
+
+Cursor Table::search(shared_ptr<const BaseFilter> filter) const {
+    return search(std::move(filter), snapshot());
+}
+
+pair<Bitmap, vector<const BaseFilter*>> Table::candidates(const BaseFilter &filter, const Snapshot &snapshot) const {
+    auto chosen = plan(filter);
+    Bitmap rows = execute(*this, chosen, snapshot.rows(), false);
+    if (chosen.kind == QueryPlan::SCAN) rows.andWith(visible(snapshot));
+    else {
+        for(size_t row = rows.nextSet(0); row < rows.size(); row = rows.nextSet(row + 1)) {
+            if (!isVisible(row, snapshot)) rows.set(row, false);
+        }
+    }
+    return {std::move(rows), std::move(chosen.residual)};
+}
+
+Cursor Table::search(shared_ptr<const BaseFilter> filter, shared_ptr<const Snapshot> snapshot) const {
+    auto [rows, residual] = candidates(*filter, *snapshot);
+    return Cursor(*this, std::move(filter), std::move(snapshot), std::move(rows), std::move(residual));
+}
+
+string Table::explain(const BaseFilter &filter) const {
+    string text;
+    function<void(const QueryPlan&, int)> print = [&](const QueryPlan &plan, int depth) {
+        static const char *kinds[] = {"INDEX", "INTERSECT", "UNION", "SCAN"};
+        text += string(depth * 2, ' ') + kinds[plan.kind];
+        if (plan.kind == QueryPlan::INDEX) text += string(" ") + plan.index + " " + plan.lookup->describe();
+        if (plan.kind == QueryPlan::SCAN) text += (plan.scan->vectorizable(*this) ? " VECTORIZED " : " ") + plan.scan->describe();
+        text += " (estimate " + to_string(plan.estimate) + " rows)\n";
+        for(auto &child: plan.children) print(child, depth + 1);
+        for(auto *check: plan.residual) text += string(depth * 2 + 2, ' ') + "FILTER " + check->describe() + "\n";
+    };
+    print(plan(filter), 0);
+    return text;
+}
+
+
+// Running state of one aggregate in one group. Integer cells sum exactly into `integer` and floating point cells
+// into `real`. low and high keep the extremes, of strings as dictionary codes.
+struct Accumulator {
+    int64_t count = 0;
+    int64_t integer = 0;
+    double real = 0;
+    int64_t low = INT64_MAX, high = INT64_MIN;
+    double realLow = INFINITY, realHigh = -INFINITY;
+};
+
+struct GroupKeyHash {
+    size_t operator()(const vector<uint64_t> &key) const {
+        uint64_t h = 0;
+        for(auto word: key) h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+};
+
+// Groups of one range of rows. A key holds every group cell in storage form, floating point cells as double bits,
+// and a mask of the null group cells last. States are indexed by group * aggregates + aggregate.
+struct PartialAggregate {
+    unordered_map<vector<uint64_t>, int, GroupKeyHash> groups;
+    vector<vector<uint64_t>> keys;
+    vector<int64_t> rows;
+    vector<Accumulator> states;
+
+    int group(const vector<uint64_t> &key, size_t aggregates) {
+        auto [it, inserted] = groups.try_emplace(key, keys.size());
+        if (inserted) {
+            keys.push_back(key);
+            rows.push_back(0);
+            states.resize(states.size() + aggregates);
+        }
+        return it->second;
+    }
+};
+
+static void extremes(Accumulator &state, const Column &column, int64_t low, int64_t high) {
+    if (column.getType() != DataType::STRING) {
+        state.low = min(state.low, low);
+        state.high = max(state.high, high);
+        return;
+    }
+    auto &dictionary = column.dict();
+    if (state.low == INT64_MAX or dictionary.decode(low) < dictionary.decode(state.low)) state.low = low;
+    if (state.high == INT64_MIN or dictionary.decode(high) > dictionary.decode(state.high)) state.high = high;
+}
+
+// Adds a chunk of selected rows to the partial: group ids first, a column at a time, then every aggregate over its
+// column with the typed cells.
+static void accumulate(const Table &table, const vector<int> &groupBy, const vector<Aggregate> &aggregates, const vector<int> &rows,
+                       PartialAggregate &partial) {
+    size_t width = groupBy.size() + 1;
+    vector<int> group(rows.size());
+    if (groupBy.empty()) partial.group(vector<uint64_t>(1), aggregates.size());
+    else {
+        vector<uint64_t> words(rows.size() * width);
+        for(size_t g = 0; g < groupBy.size(); g++) {
+            auto &column = table.column(groupBy[g]);
+            withStorageType(column.getType(), [&](auto zero) {
+                using T = decltype(zero);
+                auto &cells = column.values<T>();
+                for(size_t i = 0; i < rows.size(); i++) {
+                    if (column.isNull(rows[i])) {
+                        words[i * width + width - 1] |= 1ULL << g;
+                        continue;
+                    }
+                    if constexpr (is_floating_point_v<T>) {
+                        // Adding 0.0 folds -0.0 into the 0 group.
+                        double cell = (double)cells[rows[i]] + 0.0;
+                        memcpy(&words[i * width + g], &cell, sizeof cell);
+                    }
+                    else words[i * width + g] = (uint64_t)(int64_t)cells[rows[i]];
+                }
+            });
+        }
+        vector<uint64_t> key(width);
+        for(size_t i = 0; i < rows.size(); i++) {
+            copy(words.begin() + i * width, words.begin() + (i + 1) * width, key.begin());
+            group[i] = partial.group(key, aggregates.size());
+        }
+    }
+    for(int g: group) partial.rows[g]++;
+
+    for(size_t a = 0; a < aggregates.size(); a++) {
+        if (aggregates[a].column < 0) continue;
+        auto &column = table.column(aggregates[a].column);
+        bool extreme = aggregates[a].function == AggregateFunction::MIN or aggregates[a].function == AggregateFunction::MAX;
+        withStorageType(column.getType(), [&](auto zero) {
+            using T = decltype(zero);
+            auto &cells = column.values<T>();
+            for(size_t i = 0; i < rows.size(); i++) {
+                if (column.isNull(rows[i])) continue;
+                T cell = cells[rows[i]];
+                auto &state = partial.states[group[i] * aggregates.size() + a];
+                state.count++;
+                if constexpr (is_floating_point_v<T>) {
+                    state.real += cell;
+                    state.realLow = min(state.realLow, (double)cell);
+                    state.realHigh = max(state.realHigh, (double)cell);
+                }
+                else if constexpr (is_same_v<T, uint32_t>) {
+                    if (extreme) extremes(state, column, cell, cell);
+                }
+                else {
+                    state.integer += cell;
+                    state.low = min(state.low, (int64_t)cell);
+                    state.high = max(state.high, (int64_t)cell);
+                }
+            }
+        });
+    }
+}
+
+static void merge(const Table &table, const vector<Aggregate> &aggregates, PartialAggregate &into, const PartialAggregate &from) {
+    for(size_t g = 0; g < from.keys.size(); g++) {
+        int target = into.group(from.keys[g], aggregates.size());
+        into.rows[target] += from.rows[g];
+        for(size_t a = 0; a < aggregates.size(); a++) {
+            auto &state = into.states[target * aggregates.size() + a];
+            auto &other = from.states[g * aggregates.size() + a];
+            if (!other.count) continue;
+            state.count += other.count;
+            state.integer += other.integer;
+            state.real += other.real;
+            state.realLow = min(state.realLow, other.realLow);
+            state.realHigh = max(state.realHigh, other.realHigh);
+            extremes(state, table.column(aggregates[a].column), other.low, other.high);
+        }
+    }
+}
+
+static Value groupCell(const Column &column, uint64_t word) {
+    double real;
+    memcpy(&real, &word, sizeof real);
+    switch (column.getType()) {
+        case DataType::INT: return Value((int32_t)(int64_t)word);
+        case DataType::LONG_LONG_INT: return Value((int64_t)word);
+        case DataType::DOUBLE: return Value(real);
+        case DataType::FLOAT: return Value((float)real);
+        case DataType::STRING: return Value(string(column.dict().decode(word)), DataType::STRING);
+    }
+    return Value::null(column.getType());
+}
+
+static DataType resultType(const Table &table, const Aggregate &aggregate) {
+    if (aggregate.function == AggregateFunction::COUNT) return DataType::LONG_LONG_INT;
+    DataType type = table.column(aggregate.column).getType();
+    bool real = type == DataType::DOUBLE or type == DataType::FLOAT;
+    switch (aggregate.function) {
+        case AggregateFunction::SUM: return real ? DataType::DOUBLE : DataType::LONG_LONG_INT;
+        case AggregateFunction::AVG: return DataType::DOUBLE;
+        default: return type;
+    }
+}
+
+static Value aggregateCell(const Table &table, const Aggregate &aggregate, const Accumulator &state, int64_t rows) {
+    DataType result = resultType(table, aggregate);
+    if (aggregate.function == AggregateFunction::COUNT) return Value((int64_t)(aggregate.column < 0 ? rows : state.count));
+    if (!state.count) return Value::null(result);
+    auto &column = table.column(aggregate.column);
+    bool real = column.getType() == DataType::DOUBLE or column.getType() == DataType::FLOAT;
+    switch (aggregate.function) {
+        case AggregateFunction::SUM: return real ? Value(state.real) : Value(state.integer);
+        case AggregateFunction::AVG: return Value((real ? state.real : (double)state.integer) / state.count);
+        default: break;
+    }
+    bool min = aggregate.function == AggregateFunction::MIN;
+    switch (column.getType()) {
+        case DataType::INT: return Value((int32_t)(min ? state.low : state.high));
+        case DataType::LONG_LONG_INT: return Value((int64_t)(min ? state.low : state.high));
+        case DataType::DOUBLE: return Value(min ? state.realLow : state.realHigh);
+        case DataType::FLOAT: return Value((float)(min ? state.realLow : state.realHigh));
+        case DataType::STRING: return Value(string(column.dict().decode(min ? state.low : state.high)), DataType::STRING);
+    }
+    return Value::null(result);
+}
+
+// The selection is split into row ranges of whole blocks, one per thread. Every range aggregates into its own
+// partial groups, which are merged once all ranges are done.
+ResultSet Table::aggregate(const vector<int> &groupBy, const vector<Aggregate> &aggregates, shared_ptr<const BaseFilter> filter,
+                           shared_ptr<const Snapshot> snapshot, int threads) const {
+    if (groupBy.size() > 63) throw invalid_argument("At most 63 group columns");
+    for(int column: groupBy) {
+        if (column < 0 or column >= (int)columns.size()) throw invalid_argument("No column " + to_string(column));
+    }
+    for(auto &aggregate: aggregates) {
+        if (aggregate.column >= (int)columns.size() or (aggregate.column < 0 and aggregate.function != AggregateFunction::COUNT)) {
+            throw invalid_argument("No column for " + aggregate.describe());
+        }
+        bool numeric = aggregate.column < 0 or columns[aggregate.column]->getType() != DataType::STRING;
+        if (!numeric and (aggregate.function == AggregateFunction::SUM or aggregate.function == AggregateFunction::AVG)) {
+            throw invalid_argument(aggregate.describe() + " needs a numeric column");
+        }
+    }
+    if (!snapshot) snapshot = this->snapshot();
+    Bitmap rows;
+    vector<const BaseFilter*> residual;
+    if (filter) tie(rows, residual) = candidates(*filter, *snapshot);
+    else rows = visible(*snapshot);
+
+    threads = max(1, threads);
+    size_t slots = rows.size();
+    size_t span = max<size_t>(1, ((slots + threads - 1) / threads + BLOCK_ROWS - 1) >> BLOCK_SHIFT) << BLOCK_SHIFT;
+    size_t ranges = (slots + span - 1) / span;
+    vector<PartialAggregate> partials(max<size_t>(1, ranges));
+    parallel(ranges, threads, [&](size_t range) {
+        vector<int> chunk;
+        chunk.reserve(BLOCK_ROWS);
+        size_t end = min(slots, (range + 1) * span);
+        for(size_t row = rows.nextSet(range * span); row < end; row = rows.nextSet(row + 1)) {
+            bool matches = true;
+            for(auto *check: residual) {
+                if (!(matches = check->matches(*this, row))) break;
+            }
+            if (!matches) continue;
+            chunk.push_back(row);
+            if (chunk.size() == BLOCK_ROWS) {
+                accumulate(*this, groupBy, aggregates, chunk, partials[range]);
+                chunk.clear();
+            }
+        }
+        if (!chunk.empty()) accumulate(*this, groupBy, aggregates, chunk, partials[range]);
+    });
+    auto &total = partials[0];
+    for(size_t i = 1; i < partials.size(); i++) merge(*this, aggregates, total, partials[i]);
+    // Without group columns there is one row, even when nothing matched.
+    if (groupBy.empty()) total.group(vector<uint64_t>(1), aggregates.size());
+
+    ResultSet result;
+    for(int column: groupBy) {
+        result.names.push_back("column " + to_string(column));
+        result.types.push_back(columns[column]->getType());
+    }
+    for(auto &aggregate: aggregates) {
+        result.names.push_back(aggregate.describe());
+        result.types.push_back(resultType(*this, aggregate));
+    }
+    for(size_t g = 0; g < total.keys.size(); g++) {
+        vector<Value> row;
+        auto &key = total.keys[g];
+        for(size_t i = 0; i < groupBy.size(); i++) {
+            auto &column = *columns[groupBy[i]];
+            row.push_back(key.back() >> i & 1 ? Value::null(column.getType()) : groupCell(column, key[i]));
+        }
+        for(size_t a = 0; a < aggregates.size(); a++) {
+            row.push_back(aggregateCell(*this, aggregates[a], total.states[g * aggregates.size() + a], total.rows[g]));
+        }
+        result.rows.push_back(std::move(row));
+    }
+    sort(result.rows.begin(), result.rows.end(), [&](const vector<Value> &a, const vector<Value> &b) {
+        return lexicographical_compare(a.begin(), a.begin() + groupBy.size(), b.begin(), b.begin() + groupBy.size());
+    });
+    return result;
+}
+
+// Scan of an int and a double column against the previous layout, heap allocated rows of string cells parsed on access.
+void benchmarkScan() {
+    constexpr int ROWS = 1000000;
+    struct LegacyRow {
+        vector<string> values;
+    };
+    unordered_map<int, shared_ptr<Validator>> none;
+    auto schema = make_shared<Schema>(3, vector<DataType>({DataType::STRING, DataType::INT, DataType::DOUBLE}), none);
+    Table table(schema);
+    vector<unique_ptr<LegacyRow>> legacy;
+    mt19937 gen(3);
+    for(int i = 0; i < ROWS; i++) {
+        int quantity = gen() % 1000;
+        double price = (gen() % 100000) / 100.0;
+        vector<Value> values = {Value("user" + to_string(i), DataType::STRING), Value((int32_t)quantity), Value(price)};
+        table.insert(values);
+        legacy.push_back(make_unique<LegacyRow>(LegacyRow{{"user" + to_string(i), to_string(quantity), to_string(price)}}));
+    }
+
+    auto begin = chrono::steady_clock::now();
+    long long legacyQuantity = 0;
+    double legacyPrice = 0;
+    for(auto &row: legacy) {
+        int quantity = stoi(row->values[1]);
+        if (quantity > 500) legacyPrice += stod(row->values[2]);
+        legacyQuantity += quantity;
+    }
+    double legacySeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    begin = chrono::steady_clock::now();
+    long long quantity = 0;
+    double price = 0;
+    auto &quantities = table.column(1).values<int32_t>();
+    auto &prices = table.column(2).values<double>();
+    for(size_t b = 0; b < quantities.blockCount(); b++) {
+        const int32_t *q = quantities.block(b);
+        const double *p = prices.block(b);
+        for(size_t i = 0, n = quantities.blockSize(b); i < n; i++) {
+            if (q[i] > 500) price += p[i];
+            quantity += q[i];
+        }
+    }
+    double columnarSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << "\nScan " << ROWS << " rows, sum(quantity) and sum(price) where quantity > 500" << endl;
+    cout << "row layout: " << (size_t)(ROWS / legacySeconds) << " rows/s, columnar: " << (size_t)(ROWS / columnarSeconds) << " rows/s"
+         << (quantity == legacyQuantity ? "" : " MISMATCH") << endl;
+}
+
+// Products with a name key, quantity, price and description, indexed HASH, SORTED and INVERTED, after some churn.
+unique_ptr<Table> productTable(int rows) {
+    const vector<string> words = {"red", "green", "blue", "small", "large", "cotton", "steel", "wooden"};
+    unordered_map<int, shared_ptr<Validator>> none;
+    auto schema = make_shared<Schema>(4, vector<DataType>({DataType::STRING, DataType::INT, DataType::DOUBLE, DataType::STRING}), none, 0,
+        vector<pair<int, SecondaryIndexTypes>>({{1, SecondaryIndexTypes::HASH}, {2, SecondaryIndexTypes::SORTED}, {3, SecondaryIndexTypes::INVERTED}}));
+    auto table = make_unique<Table>(schema);
+    mt19937 gen(5);
+    auto randomRow = [&](int i) {
+        string description = words[gen() % words.size()] + " " + words[gen() % words.size()];
+        return vector<Value>({Value("user" + to_string(i), DataType::STRING), Value((int32_t)(gen() % 1000)), Value((gen() % 100000) / 100.0),
+                              Value(std::move(description), DataType::STRING)});
+    };
+    for(int i = 0; i < rows; i++) {
+        auto values = randomRow(i);
+        table->insert(values);
+    }
+    for(int i = 0; i < rows / 10; i++) {
+        auto values = randomRow(gen() % rows);
+        table->update(values);
+        table->remove(Value("user" + to_string(gen() % rows), DataType::STRING));
+    }
+    table->collectGarbage();
+    return table;
+}
+
+// Index answers must match a full scan after inserts, updates and removes, and be much cheaper than it.
+void benchmarkSecondaryIndexes() {
+    auto owner = productTable(200000);
+    Table &table = *owner;
+    auto scan = [&](auto matches) {
+        vector<int> rows;
+        for(int row = 0; row < table.size(); row++) {
+            if (table.isLive(row) and matches(row)) rows.push_back(row);
+        }
+        return rows;
+    };
+    auto &quantities = table.column(1).values<int32_t>();
+    auto &prices = table.column(2).values<double>();
+    auto *hash = table.index<HashIndex>(1);
+    auto *sorted = table.index<SortedIndex>(2);
+    auto *inverted = table.index<InvertedIndex>(3);
+
+    auto time = [](auto f) {
+        auto begin = chrono::steady_clock::now();
+        auto result = f();
+        return make_pair(result, chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count());
+    };
+    auto [equalScan, equalScanUs] = time([&] { return scan([&](int row) { return quantities[row] == 42; }); });
+    auto [equalIndex, equalIndexUs] = time([&] { return hash->equal(Value((int32_t)42)); });
+    auto [rangeScan, rangeScanUs] = time([&] { return scan([&](int row) { return prices[row] >= 100 and prices[row] < 110; }); });
+    auto [rangeIndex, rangeIndexUs] = time([&] { return sorted->range(Value(100.0), true, Value(110.0), false); });
+    auto [tokenScan, tokenScanUs] = time([&] {
+        return scan([&](int row) {
+            auto tokens = InvertedIndex::tokenize(table.column(3).get(row).get_string());
+            return binary_search(tokens.begin(), tokens.end(), "steel");
+        });
+    });
+    auto [tokenIndex, tokenIndexUs] = time([&] { return inverted->token("steel"); });
+    assert(equalScan == equalIndex and rangeScan == rangeIndex and tokenScan == tokenIndex);
+
+    cout << "\nSecondary indexes over " << table.count() << " live rows" << endl;
+    cout << "HASH quantity == 42: " << equalIndex.size() << " rows, scan " << equalScanUs << "us, index " << equalIndexUs << "us" << endl;
+    cout << "SORTED 100 <= price < 110: " << rangeIndex.size() << " rows, scan " << rangeScanUs << "us, index " << rangeIndexUs << "us" << endl;
+    cout << "INVERTED description has steel: " << tokenIndex.size() << " rows, scan " << tokenScanUs << "us, index " << tokenIndexUs << "us" << endl;
+}
+
+
+// Every plan must return exactly the rows a full scan of the filter returns.
+void benchmarkQueries() {
+    auto table = productTable(200000);
+    auto field = [](int column, Operator op, Value value) {
+        return make_shared<const FieldFilter>(column, op, std::move(value));
+    };
+    vector<pair<string, shared_ptr<const BaseFilter>>> queries = {
+        {"quantity = 42 AND price >= 500", make_shared<const AndFilter>(vector<shared_ptr<const BaseFilter>>({
+            field(1, Operator::EQUAL, Value((int32_t)42)), field(2, Operator::GREATER_EQUAL, Value(500.0))}))},
+        {"description has steel AND 100 <= price < 105", make_shared<const AndFilter>(vector<shared_ptr<const BaseFilter>>({
+            field(3, Operator::CONTAINS, Value("steel", DataType::STRING)), field(2, Operator::GREATER_EQUAL, Value(100.0)),
+            field(2, Operator::LESS, Value(105.0))}))},
+        {"quantity = 7 OR description has red wooden", make_shared<const OrFilter>(vector<shared_ptr<const BaseFilter>>({
+            field(1, Operator::EQUAL, Value((int32_t)7)), field(3, Operator::CONTAINS, Value("red wooden", DataType::STRING))}))},
+        {"price < 5 OR quantity > 995", make_shared<const OrFilter>(vector<shared_ptr<const BaseFilter>>({
+            field(2, Operator::LESS, Value(5.0)), field(1, Operator::GREATER, Value((int32_t)995))}))},
+        {"quantity != 7 AND name = user99", make_shared<const AndFilter>(vector<shared_ptr<const BaseFilter>>({
+            field(1, Operator::NOT_EQUAL, Value((int32_t)7)), field(0, Operator::EQUAL, Value("user99", DataType::STRING))}))},
+    };
+
+    cout << "\nQueries over " << table->count() << " live rows" << endl;
+    for(auto &[name, filter]: queries) {
+        auto begin = chrono::steady_clock::now();
+        vector<int> found;
+        for(auto cursor = table->search(filter); cursor.next(); ) found.push_back(cursor.slot());
+        double searchUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+
+        begin = chrono::steady_clock::now();
+        vector<int> expected;
+        for(int row = 0; row < table->size(); row++) {
+            if (table->isLive(row) and filter->matches(*table, row)) expected.push_back(row);
+        }
+        double scanUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+        assert(found == expected);
+
+        cout << name << ": " << found.size() << " rows, search " << searchUs << "us, scan " << scanUs << "us" << endl;
+        cout << table->explain(*filter);
+    }
+
+    // A constant of another type than its column is rejected instead of matching nothing.
+    for(auto filter: {field(2, Operator::GREATER_EQUAL, Value((int32_t)500)), field(1, Operator::CONTAINS, Value("7", DataType::STRING)),
+                      field(9, Operator::EQUAL, Value((int32_t)7))}) {
+        bool rejected = false;
+        try {
+            table->search(filter);
+        } catch (const invalid_argument &) {
+            rejected = true;
+        }
+        assert(rejected);
+    }
+}
+
+
+// Rows per second of each predicate type evaluated row by row, by the scalar kernel and by the AVX2 kernel.
+void benchmarkPredicates() {
+    constexpr int ROWS = 1 << 20;
+    unordered_map<int, shared_ptr<Validator>> none;
+    auto schema = make_shared<Schema>(5, vector<DataType>({DataType::INT, DataType::LONG_LONG_INT, DataType::FLOAT, DataType::DOUBLE, DataType::STRING}), none);
+    Table table(schema);
+    mt19937 gen(7);
+    for(int i = 0; i < ROWS; i++) {
+        vector<Value> values = {Value((int32_t)i), Value((int64_t)(gen() % 1000000)), Value((float)(gen() % 1000) / 10),
+                                Value((gen() % 100000) / 100.0), Value("city" + to_string(gen() % 100), DataType::STRING)};
+        table.insert(values);
+    }
+    vector<tuple<string, int, Operator, Value>> predicates = {
+        {"INT <", 0, Operator::LESS, Value((int32_t)ROWS / 2)},
+        {"INT =", 0, Operator::EQUAL, Value((int32_t)1234)},
+        {"LONG_LONG_INT >=", 1, Operator::GREATER_EQUAL, Value((int64_t)900000)},
+        {"FLOAT <=", 2, Operator::LESS_EQUAL, Value(12.5f)},
+        {"DOUBLE >", 3, Operator::GREATER, Value(500.0)},
+        {"DOUBLE !=", 3, Operator::NOT_EQUAL, Value(1.0)},
+        {"STRING =", 4, Operator::EQUAL, Value("city42", DataType::STRING)},
+    };
+    auto rate = [](auto f) {
+        auto begin = chrono::steady_clock::now();
+        auto result = f();
+        return make_pair(std::move(result), ROWS / chrono::duration<double>(chrono::steady_clock::now() - begin).count() / 1e6);
+    };
+
+    cout << "\nPredicate scans over " << ROWS << " rows, million rows/s (row by row / scalar kernel / avx2 kernel)" << endl;
+    for(auto &[name, column, op, constant]: predicates) {
+        FieldFilter filter(column, op, constant);
+        auto [rows, rowRate] = rate([&] {
+            Bitmap selection(table.size());
+            for(int row = 0; row < table.size(); row++) selection.set(row, filter.matches(table, row));
+            return selection;
+        });
+        auto [scalar, scalarRate] = rate([&] { return *scanColumn(table.column(column), op, constant, table.size(), false); });
+        cout << name << ": " << (size_t)rowRate << " / " << (size_t)scalarRate;
+        if (hasAvx2) {
+            auto [simd, simdRate] = rate([&] { return *scanColumn(table.column(column), op, constant, table.size(), true); });
+            assert(simd.data() == rows.data());
+            cout << " / " << (size_t)simdRate;
+        } else cout << " / unsupported";
+        assert(scalar.data() == rows.data());
+        cout << " (" << rows.count() << " matches)" << endl;
+    }
+    // INT < 2.5 would truncate to INT < 2, such constants get no kernel.
+    assert(!scanColumn(table.column(0), Operator::LESS, Value(2.5), table.size()));
+}
+
+
+// One writer updating rows while scanners run snapshot queries, once with MVCC and once with the scanners and the
+// writer sharing one table lock. Each scanner runs its query twice on the same snapshot and checks both agree, and
+// the writer counts the updates it committed while a scan was in progress.
+void benchmarkMvcc() {
+    constexpr int ROWS = 200000, SCANNERS = 2;
+    const auto duration = chrono::milliseconds(1000);
+    for(bool globalLock: {false, true}) {
+        unordered_map<int, shared_ptr<Validator>> none;
+        auto schema = make_shared<Schema>(3, vector<DataType>({DataType::INT, DataType::DOUBLE, DataType::INT}), none, 0,
+            vector<pair<int, SecondaryIndexTypes>>({{2, SecondaryIndexTypes::HASH}}));
+        Table table(schema);
+        mt19937 gen(11);
+        for(int i = 0; i < ROWS; i++) {
+            vector<Value> values = {Value((int32_t)i), Value((gen() % 100000) / 100.0), Value((int32_t)(gen() % 100))};
+            table.insert(values);
+        }
+        mutex lock;
+        atomic<bool> stop = false;
+        atomic<long long> scans = 0;
+        atomic<int> scanning = 0;
+        long long overlapped = 0;
+        auto query = make_shared<const FieldFilter>(1, Operator::GREATER, Value(500.0));
+        vector<thread> scanners;
+        for(int s = 0; s < SCANNERS; s++) {
+            scanners.emplace_back([&] {
+                while (!stop) {
+                    unique_lock guard(lock, defer_lock);
+                    if (globalLock) guard.lock();
+                    scanning++;
+                    auto view = table.snapshot();
+                    int first = 0, second = 0;
+                    for(auto cursor = table.search(query, view); cursor.next(); ) first++;
+                    for(auto cursor = table.search(query, view); cursor.next(); ) second++;
+                    assert(first == second);
+                    scanning--;
+                    scans += 2;
+                }
+            });
+        }
+        vector<double> latencies;
+        auto begin = chrono::steady_clock::now();
+        while (chrono::steady_clock::now() - begin < duration) {
+            auto start = chrono::steady_clock::now();
+            {
+                unique_lock guard(lock, defer_lock);
+                if (globalLock) guard.lock();
+                vector<Value> values = {Value((int32_t)(gen() % ROWS)), Value((gen() % 100000) / 100.0), Value((int32_t)(gen() % 100))};
+                table.update(values);
+                overlapped += scanning > 0;
+            }
+            latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        stop = true;
+        for(auto &scanner: scanners) scanner.join();
+        table.collectGarbage();
+        sort(latencies.begin(), latencies.end());
+
+        cout << (globalLock ? "table lock: " : "MVCC: ") << (size_t)(latencies.size() / seconds) << " updates/s, p99 "
+             << latencies[latencies.size() * 99 / 100] << "us, max " << latencies.back() << "us, " << (size_t)(scans / seconds)
+             << " scans/s, " << overlapped << " updates committed during a scan, " << table.versionCount() << " versions kept for " << table.count() << " rows" << endl;
+    }
+}
+
+
+// Churn keeps the slot count flat through slot reuse, then a mass delete is compacted in the background while
+// row ids keep pointing at the same rows and queries keep their answers.
+void benchmarkCompaction() {
+    constexpr int ROWS = 200000;
+    unordered_map<int, shared_ptr<Validator>> none;
+    auto schema = make_shared<Schema>(3, vector<DataType>({DataType::INT, DataType::DOUBLE, DataType::INT}), none, 0,
+        vector<pair<int, SecondaryIndexTypes>>({{2, SecondaryIndexTypes::HASH}}));
+    Table table(schema);
+    mt19937 gen(13);
+    int nextKey = 0;
+    vector<int> keys;
+    auto insert = [&] {
+        vector<Value> values = {Value((int32_t)nextKey), Value((gen() % 100000) / 100.0), Value((int32_t)(gen() % 100))};
+        table.insert(values);
+        keys.push_back(nextKey++);
+    };
+    auto removeRandom = [&] {
+        swap(keys[gen() % keys.size()], keys.back());
+        table.remove(Value((int32_t)keys.back()));
+        keys.pop_back();
+    };
+    auto query = make_shared<const FieldFilter>(1, Operator::GREATER, Value(900.0));
+    // Best of three runs, the first one after compaction pays for cold caches.
+    auto check = [&] {
+        double us = 1e18;
+        int found = 0, expected = 0;
+        for(int run = 0; run < 3; run++) {
+            auto begin = chrono::steady_clock::now();
+            found = 0;
+            for(auto cursor = table.search(query); cursor.next(); ) found++;
+            us = min(us, chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count());
+        }
+        for(int row = 0; row < table.size(); row++) expected += table.isLive(row) and query->matches(table, row);
+        assert(found == expected);
+        return us;
+    };
+
+    for(int i = 0; i < ROWS; i++) insert();
+    cout << "\nCompaction" << endl;
+    for(int round = 0; round < 5; round++) {
+        for(int i = 0; i < ROWS / 10; i++) {
+            removeRandom();
+            insert();
+        }
+        table.collectGarbage();
+        cout << "churn round " << round << ": " << table.count() << " rows in " << table.size() << " slots" << endl;
+    }
+
+    while ((int)keys.size() > ROWS / 10) removeRandom();
+    vector<pair<int, vector<Value>>> tracked;
+    for(int i = 0; i < 100; i++) {
+        auto values = vector<Value>({Value((int32_t)keys[gen() % keys.size()])});
+        int id = -1;
+        for(int row = 0; row < table.size(); row++) {
+            if (table.isLive(row) and table.column(0).get(row) == values[0]) id = table.rowIdOf(row);
+        }
+        tracked.emplace_back(id, table.getRow(table.slotOf(id)));
+    }
+    double before = check();
+    int slotsBefore = table.size();
+
+    auto begin = chrono::steady_clock::now();
+    table.startCompaction(chrono::milliseconds(1), chrono::microseconds(500));
+    while (table.size() > table.count() + (int)BLOCK_ROWS and chrono::steady_clock::now() - begin < chrono::seconds(30)) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    table.stopCompaction();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for(auto &[id, values]: tracked) assert(table.getRow(table.slotOf(id)) == values);
+
+    cout << "after deleting 90%: " << table.count() << " rows in " << slotsBefore << " slots, query " << before << "us" << endl;
+    cout << "compacted in " << seconds << "s of 500us steps: " << table.count() << " rows in " << table.size() << " slots, query "
+         << check() << "us" << endl;
+
+    // An update after garbage collection reuses the slot of the collected version its predecessor still points at.
+    Table small(schema);
+    auto row = [](int key, double value) { return vector<Value>({Value((int32_t)key), Value(value), Value((int32_t)0)}); };
+    auto pad = row(0, 0), first = row(1, 1), second = row(1, 2), third = row(1, 3);
+    small.insert(pad);
+    small.insert(first);
+    small.update(second);
+    small.collectGarbage();
+    auto view = small.snapshot();
+    small.update(third);
+    auto key = make_shared<const FieldFilter>(0, Operator::EQUAL, Value((int32_t)1));
+    vector<vector<Value>> found;
+    for(auto cursor = small.search(key); cursor.next(); ) found.push_back(cursor.row());
+    assert(found == vector<vector<Value>>({third}));
+    {
+        auto guard = small.readIndexes();
+        assert(small.versions(Value((int32_t)1)).size() == 2);
+    }
+    view.reset();
+
+    // A removed and re-inserted key gets a new row id, the old one is freed once its last version is collected.
+    int oldId = -1;
+    for(int slot = 0; slot < small.size(); slot++) {
+        if (small.isLive(slot) and small.column(0).get(slot) == Value((int32_t)1)) oldId = small.rowIdOf(slot);
+    }
+    small.remove(Value((int32_t)1));
+    small.insert(third);
+    small.collectGarbage();
+    assert(small.slotOf(oldId) == -1);
+}
+
+
+// The same rules as std::function validators checked row by row on insert, and as compiled constraints checked
+// per batch by insertBatch. About 2% of the rows break a rule and both loads must reject the same ones.
+void benchmarkLoad() {
+    constexpr int ROWS = 200000, BATCH = 4096;
+    const vector<DataType> types = {DataType::STRING, DataType::INT, DataType::DOUBLE, DataType::STRING};
+    const string emailPattern = "[a-z0-9.]+@[a-z]+\\.com";
+    mt19937 gen(17);
+    vector<vector<Value>> rows;
+    for(int i = 0; i < ROWS; i++) {
+        bool bad = gen() % 50 == 0;
+        string email = "user" + to_string(i) + (bad and i % 2 ? "@mail" : "@mail.com");
+        int age = bad and i % 2 == 0 ? 150 : gen() % 100;
+        rows.push_back({Value(std::move(email), DataType::STRING), Value((int32_t)age), Value((gen() % 10000) / 100.0),
+                        Value(string(gen() % 2 ? "IN" : "US"), DataType::STRING)});
+    }
+
+    regex email(emailPattern);
+    unordered_map<int, shared_ptr<Validator>> validators = {
+        {0, make_shared<Validator>([&](const Value &v) { return v.get_string().size() > 0 and regex_match(v.get_string(), email); })},
+        {1, make_shared<Validator>([](const Value &v) { return v.getInteger() >= 0 and v.getInteger() <= 120; })},
+        {2, make_shared<Validator>([](const Value &v) { return v.get_double() >= 0 and v.get_double() <= 100; })},
+        {3, make_shared<Validator>([](const Value &v) { return v.get_string().size() == 2; })},
+    };
+    auto legacySchema = make_shared<Schema>(4, types, validators);
+    Table legacy(legacySchema);
+    auto begin = chrono::steady_clock::now();
+    for(auto &row: rows) legacySchema->validate(row);
+    double legacyValidate = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    begin = chrono::steady_clock::now();
+    int legacyRejected = 0;
+    for(auto &row: rows) {
+        auto values = row;
+        legacyRejected += legacy.insert(values).first != 0;
+    }
+    double legacySeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    unordered_map<int, shared_ptr<Validator>> none;
+    auto compiledSchema = make_shared<Schema>(4, types, none, 0, vector<pair<int, SecondaryIndexTypes>>(), vector<Constraint>({
+        Constraint::required(0), Constraint::regex(0, emailPattern), Constraint::range(1, 0, 120), Constraint::range(2, 0, 100),
+        Constraint::notNull(3), Constraint::length(3, 2, 2)}));
+    Table compiled(compiledSchema);
+    vector<vector<vector<Value>>> batches;
+    for(int from = 0; from < ROWS; from += BATCH) batches.emplace_back(rows.begin() + from, rows.begin() + min(ROWS, from + BATCH));
+    begin = chrono::steady_clock::now();
+    for(auto &batch: batches) compiledSchema->validateBatch(batch);
+    double compiledValidate = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    begin = chrono::steady_clock::now();
+    int compiledRejected = 0;
+    for(auto &batch: batches) compiledRejected += compiled.insertBatch(batch).errors.size();
+    double compiledSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    assert(legacyRejected == compiledRejected and legacy.count() == compiled.count());
+
+    vector<vector<Value>> sample(rows.begin(), rows.begin() + 4);
+    sample.push_back({Value("bad", DataType::STRING), Value((int32_t)200), Value(1.0), Value("", DataType::STRING)});
+    sample.push_back(sample[1]);
+    Table errors(make_shared<Schema>(4, types, none, 0, vector<pair<int, SecondaryIndexTypes>>(), vector<Constraint>({
+        Constraint::required(0), Constraint::regex(0, emailPattern), Constraint::range(1, 0, 120), Constraint::required(3)})));
+    auto result = errors.insertBatch(sample);
+
+    cout << "\nLoad " << ROWS << " rows, " << compiledRejected << " rejected" << endl;
+    cout << "std::function validators: validate " << (size_t)(ROWS / legacyValidate) << " rows/s, row inserts "
+         << (size_t)(ROWS / legacySeconds) << " rows/s" << endl;
+    cout << "compiled constraints: validate " << (size_t)(ROWS / compiledValidate) << " rows/s, insertBatch(" << BATCH << ") "
+         << (size_t)(ROWS / compiledSeconds) << " rows/s" << endl;
+    cout << "sample batch: " << result.inserted << " inserted";
+    for(auto &[row, error]: result.errors) cout << ", row " << row << ": " << error;
+    cout << endl;
+}
+
+// Restarting from a CSV dump by parsing and inserting row by row, by the parallel importer, and from a binary table
+// file. Every path must end with the same rows and answer a query the same way.
+void benchmarkBulkLoad() {
+    auto source = productTable(200000);
+    auto schema = source->getSchema();
+    auto directory = filesystem::temp_directory_path();
+    string csvPath = directory / "in_memory_db_products.csv", tablePath = directory / "in_memory_db_products.table";
+    {
+        ofstream csv(csvPath);
+        csv << "name,quantity,price,description\n";
+        auto view = source->snapshot();
+        Bitmap rows = source->visible(*view);
+        for(size_t row = rows.nextSet(0); row < rows.size(); row = rows.nextSet(row + 1)) {
+            auto values = source->getRow(row);
+            csv << values[0].get_string() << ',' << values[1].get_string() << ',' << values[2].get_string() << ",\"" << values[3].get_string() << "\"\n";
+        }
+        // A short record, a repeated key and a field that does not parse, all rejected.
+        csv << "broken,1,1.5\nuser0x,1,1,\"\"\"quoted, text\"\"\"\nuser0x,2,2,blue\nuser0y,12x,1,red\n";
+    }
+    auto elapsed = [](auto f) {
+        auto begin = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    };
+    auto query = make_shared<const AndFilter>(vector<shared_ptr<const BaseFilter>>({
+        make_shared<const FieldFilter>(3, Operator::CONTAINS, Value("steel", DataType::STRING)),
+        make_shared<const FieldFilter>(2, Operator::GREATER_EQUAL, Value(500.0)), make_shared<const FieldFilter>(2, Operator::LESS, Value(600.0))}));
+    auto matches = [&](const Table &table) {
+        int found = 0;
+        for(auto cursor = table.search(query); cursor.next(); ) found++;
+        return found;
+    };
+    int expected = source->count() + 1;
+
+    Table rowByRow(schema);
+    double rowSeconds = elapsed([&] {
+        ifstream csv(csvPath);
+        string line;
+        getline(csv, line);
+        while (getline(csv, line)) {
+            auto fields = csvFields(line);
+            if (fields.size() != 4) continue;
+            vector<Value> values;
+            bool parsed = true;
+            for(int i = 0; i < 4; i++) {
+                parsed = parsed and (fields[i].empty() or !Value(string(fields[i]), schema->getTypes()[i]).isNull());
+                values.emplace_back(std::move(fields[i]), schema->getTypes()[i]);
+            }
+            if (parsed) rowByRow.insert(values);
+        }
+    });
+    assert(rowByRow.count() == expected);
+    cout << "\nBulk load of " << expected << " rows" << endl;
+    cout << "CSV row inserts: " << (size_t)(expected / rowSeconds) << " rows/s" << endl;
+
+    set<int> threadCounts = {1, 4, max(1, (int)thread::hardware_concurrency())};
+    for(int threads: threadCounts) {
+        Table imported(schema);
+        Table::BatchResult result;
+        double seconds = elapsed([&] { result = imported.importCsv(csvPath, threads); });
+        assert(result.inserted == expected and imported.count() == expected and matches(imported) == matches(rowByRow));
+        assert(result.errors.size() == 3 and result.errors.back().second == "column 1 does not parse");
+        cout << "CSV import, " << threads << " threads: " << (size_t)(expected / seconds) << " rows/s";
+        for(auto &[row, error]: result.errors) cout << ", row " << row << ": " << error;
+        cout << endl;
+    }
+
+    double saveSeconds = elapsed([&] { rowByRow.save(tablePath); });
+    Table loaded(schema);
+    double loadSeconds = elapsed([&] { loaded.load(tablePath); });
+    assert(loaded.count() == expected and matches(loaded) == matches(rowByRow));
+    for(int row = 0; row < loaded.size(); row += 997) {
+        auto values = loaded.getRow(row);
+        auto guard = loaded.readIndexes();
+        assert(loaded.versions(values[0]) == vector<int>({row}));
+    }
+    // The bulk built indexes take ordinary writes afterwards.
+    for(int i = 0; i < 1000; i++) {
+        vector<Value> values = {Value("new" + to_string(i), DataType::STRING), Value((int32_t)i), Value(550.0), Value("steel", DataType::STRING)};
+        loaded.insert(values);
+        rowByRow.insert(values);
+    }
+    assert(loaded.count() == expected + 1000 and matches(loaded) == matches(rowByRow));
+    cout << "binary table file: " << filesystem::file_size(tablePath) / 1024 << " KiB, save " << (size_t)(expected / saveSeconds)
+         << " rows/s, load " << (size_t)(expected / loadSeconds) << " rows/s" << endl;
+
+    // A file whose second key repeats the first is rejected and leaves the table empty. The key column is the first
+    // chunk after the header, the column types and the index list, and its cells follow its validity words.
+    {
+        fstream file(tablePath, ios::in | ios::out | ios::binary);
+        size_t cells = sizeof(TableFileHeader) + (4 * sizeof(uint32_t) + 7) / 8 * 8 + (3 * 2 * sizeof(uint32_t) + 7) / 8 * 8 +
+                       (expected + 63) / 64 * sizeof(uint64_t);
+        uint32_t code;
+        file.seekg(cells);
+        file.read((char*)&code, sizeof code);
+        file.seekp(cells + sizeof code);
+        file.write((const char*)&code, sizeof code);
+    }
+    Table duplicated(schema);
+    bool rejected = false;
+    try {
+        duplicated.load(tablePath);
+    } catch (const runtime_error &e) {
+        rejected = string(e.what()).starts_with("Duplicate primary key");
+    }
+    assert(rejected and duplicated.count() == 0 and duplicated.size() == 0);
+    filesystem::remove(csvPath);
+    filesystem::remove(tablePath);
+}
+
+
+// Group by over a filtered selection against exporting the matching rows and aggregating them outside the table,
+// then the same query at several thread counts.
+void benchmarkAggregation() {
+    auto table = productTable(200000);
+    auto filter = make_shared<const FieldFilter>(2, Operator::GREATER_EQUAL, Value(100.0));
+    vector<Aggregate> aggregates = {{AggregateFunction::COUNT, -1}, {AggregateFunction::SUM, 2}, {AggregateFunction::AVG, 2},
+                                    {AggregateFunction::MIN, 2}, {AggregateFunction::MAX, 3}};
+    auto elapsed = [](auto f) {
+        auto begin = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    };
+
+    struct Exported {
+        int64_t count = 0;
+        double sum = 0, low = INFINITY;
+        string high;
+    };
+    map<int, Exported> exported;
+    double exportMs = elapsed([&] {
+        for(auto cursor = table->search(filter); cursor.next(); ) {
+            auto row = cursor.row();
+            auto &group = exported[*row[1].getInteger()];
+            group.count++;
+            group.sum += *row[2].get_double();
+            group.low = min(group.low, *row[2].get_double());
+            group.high = max(group.high, row[3].get_string());
+        }
+    });
+
+    cout << "\nGroup by quantity: " << aggregates[0].describe() << ", " << aggregates[1].describe() << ", " << aggregates[2].describe()
+         << ", " << aggregates[3].describe() << ", " << aggregates[4].describe() << " where " << filter->describe() << endl;
+    cout << "export rows and aggregate: " << exportMs << "ms" << endl;
+    set<int> threadCounts = {1, 4, max(1, (int)thread::hardware_concurrency())};
+    for(int threads: threadCounts) {
+        ResultSet result;
+        double ms = elapsed([&] { result = table->aggregate({1}, aggregates, filter, nullptr, threads); });
+        assert(result.rows.size() == exported.size());
+        for(auto &row: result.rows) {
+            auto &expected = exported.at(*row[0].getInteger());
+            assert(row[1].as<int64_t>() == expected.count and fabs(row[2].as<double>() - expected.sum) < 1e-6 * expected.sum);
+            assert(row[4].as<double>() == expected.low and row[5].get_string() == expected.high);
+        }
+        cout << "aggregate, " << threads << " threads: " << ms << "ms, " << result.rows.size() << " groups" << endl;
+    }
+
+    auto totals = table->aggregate({}, {{AggregateFunction::COUNT, -1}, {AggregateFunction::SUM, 1}, {AggregateFunction::AVG, 2}});
+    assert(totals.rows.size() == 1 and totals.rows[0][0].as<int64_t>() == table->count());
+    totals.print();
+    auto byDescription = table->aggregate({3}, {{AggregateFunction::COUNT, -1}, {AggregateFunction::AVG, 1}, {AggregateFunction::MAX, 0}},
+                                          make_shared<const FieldFilter>(1, Operator::LESS, Value((int32_t)5)));
+    byDescription.rows.resize(3);
+    byDescription.print();
+}
+
+
+int main () {
+    auto v1 = make_shared<Validator>([](const Value& value) -> bool {
+        if (value.get_string().size() == 0) return false;
+        cout << value.get_string() << endl;
+        return value.get_string() > "a" and value.get_string() < "y";
+    });
+
+    auto v2 = make_shared<Validator>([](const Value& value) -> bool {
+        cout << value.get_string() << endl;
+        return value.getInteger() >= 10;
+    });
+
+    auto v3 = make_shared<Validator>([](const Value& value) -> bool {
+        cout << value.get_string() << endl;
+        return value.get_double() >= 4.5;
+    });
+
+    unordered_map<int, shared_ptr<Validator>> validators = {
+        {0, std::move(v1)},
+        {1, std::move(v2)},
+        {2, std::move(v3)}
+    } ;
+    auto schema = make_shared<Schema>(3, vector<DataType>({DataType::STRING, DataType::INT, DataType::DOUBLE}), validators);
+    Table t(schema);
+    vector<Value> values = vector<Value>({ Value("Ritwiz", DataType::STRING), Value("100", DataType::INT), Value("1866.5", DataType::DOUBLE)});
+    auto [result, message] = t.insert(values);
+    cout << message << endl;
+    values = vector<Value>({ Value("ritwiz", DataType::STRING), Value("100", DataType::INT), Value("1866.5", DataType::DOUBLE)});
+    cout << t.insert(values).second << endl;
+    t.printRows();
+
+    benchmarkScan();
+    benchmarkSecondaryIndexes();
+    benchmarkQueries();
+    benchmarkPredicates();
+
+    cout << "\nMixed updates and scans, " << thread::hardware_concurrency() << " hardware threads" << endl;
+    benchmarkMvcc();
+    benchmarkCompaction();
+    benchmarkLoad();
+    benchmarkBulkLoad();
+    benchmarkAggregation();
 }
@@ -41,7 +41,34 @@ IndexPersistence
 #include <fstream>
 #include <sstream>
 #include <unordered_set>
+#include <unordered_map>
+#include <vector>
+#include <memory>
 #include <cassert>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <string_view>
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <optional>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 namespace fs = filesystem;
@@ -61,6 +88,533 @@ class Utilities {
     }
 };
 
+// Binary posting list: a header, one skip entry per full block, then the blocks. Doc ids are delta encoded, every
+// full block of 128 deltas is bit packed with the width of its largest delta, and the tail is varints.
+// A block stores its deltas in four interleaved lanes, delta i in lane i % 4, so four of them unpack per SSE2 step.
+// The term frequencies of a block, less one, follow its doc ids packed the same way, and the tail frequencies follow
+// the tail doc ids. Each block records the largest frequency and the fewest words over its docs, which bound the
+// score of any of them.
+class PostingCodec {
+    public:
+    static constexpr int BLOCK = 128;
+    struct Header {
+        uint32_t count;
+        uint32_t blocks;
+        // Bytes after the header: skip entries and data.
+        uint32_t bytes;
+        // Largest term frequency and fewest words over the tail's docs.
+        uint32_t tailMaxFreq;
+        uint32_t tailMinLength;
+    };
+    // Last doc id of a block and where the block starts, relative to the end of the skip entries, and the block's
+    // largest term frequency and fewest words.
+    struct Skip {
+        uint32_t last;
+        uint32_t offset;
+        uint32_t maxFreq;
+        uint32_t minLength;
+    };
+
+    private:
+    static int width(uint32_t v) {
+        return v ? 32 - __builtin_clz(v) : 0;
+    }
+
+    static void pack(const uint32_t *deltas, int bits, string &out) {
+        if (!bits) return;
+        vector<uint32_t> words(bits * 4);
+        for(int i = 0; i < BLOCK; i++) {
+            int lane = i % 4, position = (i / 4) * bits, word = position / 32, shift = position % 32;
+            words[word * 4 + lane] |= deltas[i] << shift;
+            if (shift + bits > 32) words[(word + 1) * 4 + lane] |= deltas[i] >> (32 - shift);
+        }
+        out.append((const char*)words.data(), words.size() * sizeof(uint32_t));
+    }
+
+    static void unpack(const uint8_t *in, int bits, uint32_t *out) {
+        uint32_t words[4 * 32], mask = bits == 32 ? ~0u : (1u << bits) - 1;
+        memcpy(words, in, bits * 16);
+        for(int i = 0; i < BLOCK; i++) {
+            int lane = i % 4, position = (i / 4) * bits, word = position / 32, shift = position % 32;
+            uint64_t v = words[word * 4 + lane] >> shift;
+            if (shift + bits > 32) v |= (uint64_t)words[(word + 1) * 4 + lane] << (32 - shift);
+            out[i] = v & mask;
+        }
+    }
+
+    // Start of block `block`, or of the tail when block is the number of full blocks.
+    static const uint8_t *blockData(const char *list, uint32_t block) {
+        auto blocks = header(list).blocks;
+        auto *in = (const uint8_t*)list + sizeof(Header) + blocks * sizeof(Skip);
+        if (block < blocks) return in + skip(list, block).offset;
+        if (!blocks) return in;
+        in += skip(list, blocks - 1).offset;
+        in += 1 + 16 * in[0];
+        return in + 1 + 16 * in[0];
+    }
+
+    static void putVarint(uint32_t v, string &out) {
+        while (v >= 0x80) {
+            out += (char)(v | 0x80);
+            v >>= 7;
+        }
+        out += (char)v;
+    }
+
+    static uint32_t getVarint(const uint8_t *&in) {
+        uint32_t v = 0;
+        for(int shift = 0; ; shift += 7) {
+            uint8_t byte = *in++;
+            v |= (uint32_t)(byte & 0x7f) << shift;
+            if (byte < 0x80) return v;
+        }
+    }
+
+    public:
+    // `lengths` holds the word count of each doc.
+    static void encode(const vector<int> &docs, const vector<int> &freqs, const vector<uint32_t> &lengths, string &out) {
+        Header header = {(uint32_t)docs.size(), (uint32_t)(docs.size() / BLOCK), 0, 0, UINT32_MAX};
+        vector<Skip> skips;
+        string data;
+        uint32_t previous = 0, deltas[BLOCK], counts[BLOCK];
+        size_t i = 0;
+        for(; i + BLOCK <= docs.size(); i += BLOCK) {
+            uint32_t widest = 0, widestCount = 0, largest = 0, shortest = UINT32_MAX;
+            for(int j = 0; j < BLOCK; j++) {
+                deltas[j] = docs[i + j] - previous;
+                previous = docs[i + j];
+                widest |= deltas[j];
+                counts[j] = freqs[i + j] - 1;
+                widestCount |= counts[j];
+                largest = max(largest, (uint32_t)freqs[i + j]);
+                shortest = min(shortest, lengths[i + j]);
+            }
+            skips.push_back({previous, (uint32_t)data.size(), largest, shortest});
+            data += (char)width(widest);
+            pack(deltas, width(widest), data);
+            data += (char)width(widestCount);
+            pack(counts, width(widestCount), data);
+        }
+        for(size_t j = i; j < docs.size(); j++) {
+            putVarint(docs[j] - previous, data);
+            previous = docs[j];
+        }
+        for(size_t j = i; j < docs.size(); j++) {
+            putVarint(freqs[j] - 1, data);
+            header.tailMaxFreq = max(header.tailMaxFreq, (uint32_t)freqs[j]);
+            header.tailMinLength = min(header.tailMinLength, lengths[j]);
+        }
+        header.bytes = skips.size() * sizeof(Skip) + data.size();
+        out.append((const char*)&header, sizeof header);
+        out.append((const char*)skips.data(), skips.size() * sizeof(Skip));
+        out += data;
+    }
+
+    static Header header(const char *list) {
+        Header header;
+        memcpy(&header, list, sizeof header);
+        return header;
+    }
+
+    static Skip skip(const char *list, uint32_t block) {
+        Skip skip;
+        memcpy(&skip, list + sizeof(Header) + block * sizeof(Skip), sizeof skip);
+        return skip;
+    }
+
+    // Decodes full block `block` into 128 doc ids, `base` is the last doc id of the block before, 0 for the first.
+    static void decodeBlock(const char *list, uint32_t block, uint32_t base, uint32_t *out, bool simd = true) {
+        auto *in = blockData(list, block);
+        int bits = *in++;
+        uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+#if defined(__SSE2__)
+        if (simd) {
+            __m128i lanes = _mm_set1_epi32(mask), carry = _mm_set1_epi32(base);
+            for(int j = 0; j < BLOCK / 4; j++) {
+                int position = j * bits, word = position / 32, shift = position % 32;
+                __m128i v = _mm_srl_epi32(_mm_loadu_si128((const __m128i*)in + word), _mm_cvtsi32_si128(shift));
+                if (shift + bits > 32) {
+                    v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128((const __m128i*)in + word + 1), _mm_cvtsi32_si128(32 - shift)));
+                }
+                v = _mm_and_si128(v, lanes);
+                // Prefix sum of the four deltas, plus the last doc id before them.
+                v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+                v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+                v = _mm_add_epi32(v, carry);
+                _mm_storeu_si128((__m128i*)out + j, v);
+                carry = _mm_shuffle_epi32(v, 0xff);
+            }
+            return;
+        }
+#endif
+        uint32_t words[4 * 32];
+        memcpy(words, in, bits * 16);
+        for(int i = 0; i < BLOCK; i++) {
+            int lane = i % 4, position = (i / 4) * bits, word = position / 32, shift = position % 32;
+            uint64_t v = words[word * 4 + lane] >> shift;
+            if (shift + bits > 32) v |= (uint64_t)words[(word + 1) * 4 + lane] << (32 - shift);
+            base += v & mask;
+            out[i] = base;
+        }
+    }
+
+    // Term frequencies of full block `block`.
+    static void decodeFreqs(const char *list, uint32_t block, uint32_t *out) {
+        auto *in = blockData(list, block);
+        in += 1 + 16 * in[0];
+        unpack(in + 1, in[0], out);
+        for(int i = 0; i < BLOCK; i++) out[i]++;
+    }
+
+    // Decodes the varint tail after the full blocks into out, and its frequencies into freqs when given, returns how
+    // many doc ids it holds.
+    static uint32_t decodeTail(const char *list, uint32_t base, uint32_t *out, uint32_t *freqs = nullptr) {
+        auto h = header(list);
+        auto *in = blockData(list, h.blocks);
+        uint32_t count = h.count - h.blocks * BLOCK;
+        for(uint32_t i = 0; i < count; i++) {
+            base += getVarint(in);
+            out[i] = base;
+        }
+        for(uint32_t i = 0; freqs and i < count; i++) freqs[i] = getVarint(in) + 1;
+        return count;
+    }
+
+    static vector<int> decode(const char *list, bool simd = true) {
+        auto h = header(list);
+        vector<int> docs(h.count);
+        uint32_t base = 0;
+        for(uint32_t b = 0; b < h.blocks; b++) {
+            decodeBlock(list, b, base, (uint32_t*)docs.data() + b * BLOCK, simd);
+            base = docs[(b + 1) * BLOCK - 1];
+        }
+        decodeTail(list, base, (uint32_t*)docs.data() + h.blocks * BLOCK);
+        return docs;
+    }
+
+    static vector<int> frequencies(const char *list) {
+        auto h = header(list);
+        vector<int> freqs(h.count);
+        for(uint32_t b = 0; b < h.blocks; b++) decodeFreqs(list, b, (uint32_t*)freqs.data() + b * BLOCK);
+        vector<uint32_t> tail(BLOCK);
+        decodeTail(list, 0, tail.data(), (uint32_t*)freqs.data() + h.blocks * BLOCK);
+        return freqs;
+    }
+
+    // Walks one encoded list a block at a time. advance finds the block that can hold a target from the skip
+    // entries, so the blocks before it are never decoded.
+    class Reader {
+        const char *list;
+        Header h;
+        // Loaded block, h.blocks for the tail.
+        uint32_t block = 0;
+        uint32_t docs[BLOCK], freqs[BLOCK];
+        uint32_t size = 0, position = 0;
+        // Frequencies are decoded the first time a doc of the block is scored.
+        bool freqsLoaded = false;
+
+        void load(uint32_t b) {
+            block = b;
+            position = 0;
+            uint32_t base = b ? skip(list, b - 1).last : 0;
+            freqsLoaded = b == h.blocks;
+            if (b < h.blocks) {
+                decodeBlock(list, b, base, docs);
+                size = BLOCK;
+            }
+            else size = decodeTail(list, base, docs, freqs);
+        }
+
+        public:
+        explicit Reader(const char *list): list(list), h(header(list)) {
+            load(0);
+        }
+
+        uint32_t count() const {
+            return h.count;
+        }
+
+        // Largest of weight(largest frequency, fewest words) over the blocks, and over the loaded block.
+        template<class Weight>
+        double bound(Weight weight) const {
+            double bound = h.count > h.blocks * BLOCK ? weight(h.tailMaxFreq, h.tailMinLength) : 0;
+            for(uint32_t b = 0; b < h.blocks; b++) {
+                auto s = skip(list, b);
+                bound = max(bound, weight(s.maxFreq, s.minLength));
+            }
+            return bound;
+        }
+
+        template<class Weight>
+        double blockBound(Weight weight) const {
+            if (block == h.blocks) return weight(h.tailMaxFreq, h.tailMinLength);
+            auto s = skip(list, block);
+            return weight(s.maxFreq, s.minLength);
+        }
+
+        // Last doc id of the loaded block.
+        uint32_t blockLast() const {
+            return docs[size - 1];
+        }
+
+        bool done() const {
+            return position >= size;
+        }
+
+        uint32_t doc() const {
+            return docs[position];
+        }
+
+        uint32_t freq() {
+            if (!freqsLoaded) {
+                decodeFreqs(list, block, freqs);
+                freqsLoaded = true;
+            }
+            return freqs[position];
+        }
+
+        void next() {
+            if (++position == size and block < h.blocks) load(block + 1);
+        }
+
+        // Moves to the first doc id >= target, or to the end.
+        void advance(uint32_t target) {
+            if (done()) return;
+            if (docs[size - 1] < target) {
+                if (block == h.blocks) {
+                    position = size;
+                    return;
+                }
+                uint32_t low = block + 1, high = h.blocks;
+                while (low < high) {
+                    uint32_t middle = (low + high) / 2;
+                    if (skip(list, middle).last < target) low = middle + 1;
+                    else high = middle;
+                }
+                load(low);
+            }
+            position = lower_bound(docs + position, docs + size, target) - docs;
+        }
+    };
+
+    // Encoded size of the list starting at `list`.
+    static size_t size(const char *list) {
+        return sizeof(Header) + header(list).bytes;
+    }
+};
+
+// Segment file: the posting lists, then the dictionary. The dictionary is one fixed width entry per term in sorted
+// order, the term bytes, and an open addressing table of entry numbers by term hash at most half full, so a lookup
+// is one hash and usually one probe into the mapped file. After the dictionary come the word counts of the
+// segment's docs, a contiguous range of doc ids. The footer at the end locates the dictionary and the lengths.
+struct SegmentFooter {
+    static constexpr uint64_t MAGIC = 0x32474553584449ULL;
+    uint64_t entries;
+    uint64_t strings;
+    uint64_t table;
+    uint32_t terms;
+    uint32_t slots;
+    uint64_t lengths;
+    uint32_t firstDoc;
+    uint32_t docs;
+    uint64_t magic;
+};
+
+struct TermEntry {
+    uint64_t postings;
+    uint32_t key;
+    uint32_t length;
+};
+
+static uint64_t termHash(string_view term) {
+    uint64_t h = 14695981039346656037ULL;
+    for(char c : term) h = (h ^ (uint8_t)c) * 1099511628211ULL;
+    return h;
+}
+
+// A segment file mapped read only. A retired segment deletes its file once the last reader lets go of it.
+class Segment {
+    string path;
+    const char *bytes = nullptr;
+    size_t length = 0;
+    SegmentFooter footer;
+    atomic<bool> retired = false;
+
+    TermEntry entry(size_t i) const {
+        TermEntry e;
+        memcpy(&e, bytes + footer.entries + i * sizeof(TermEntry), sizeof e);
+        return e;
+    }
+
+    public:
+    explicit Segment(const string &path): path(path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Cannot open " + path);
+        struct stat info;
+        if (fstat(fd, &info) == 0) length = info.st_size;
+        if (length >= sizeof footer) {
+            void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) bytes = (const char*)mapped;
+        }
+        close(fd);
+        if (!bytes) throw runtime_error("Cannot map " + path);
+        memcpy(&footer, bytes + length - sizeof footer, sizeof footer);
+        if (footer.magic != SegmentFooter::MAGIC) {
+            munmap((void*)bytes, length);
+            throw runtime_error(path + " is not a segment");
+        }
+    }
+
+    ~Segment() {
+        munmap((void*)bytes, length);
+        error_code ignored;
+        if (retired) fs::remove(path, ignored);
+    }
+
+    Segment(const Segment&) = delete;
+    Segment &operator=(const Segment&) = delete;
+
+    void retire() {
+        retired = true;
+    }
+
+    size_t bytesOnDisk() const {
+        return length;
+    }
+
+    size_t terms() const {
+        return footer.terms;
+    }
+
+    string_view term(size_t i) const {
+        auto e = entry(i);
+        return string_view(bytes + footer.strings + e.key, e.length);
+    }
+
+    const char *postings(size_t i) const {
+        return bytes + entry(i).postings;
+    }
+
+    // Encoded posting list of a term, nullptr when the segment does not have it.
+    const char *find(string_view term) const {
+        auto *table = (const uint32_t*)(bytes + footer.table);
+        for(uint64_t slot = termHash(term) & (footer.slots - 1); table[slot]; slot = (slot + 1) & (footer.slots - 1)) {
+            if (this->term(table[slot] - 1) == term) return postings(table[slot] - 1);
+        }
+        return nullptr;
+    }
+
+    uint32_t firstDoc() const {
+        return footer.firstDoc;
+    }
+
+    uint32_t docs() const {
+        return footer.docs;
+    }
+
+    // Word count of a doc of the segment.
+    uint32_t docLength(uint32_t doc) const {
+        uint32_t words;
+        memcpy(&words, bytes + footer.lengths + (doc - footer.firstDoc) * sizeof(uint32_t), sizeof words);
+        return words;
+    }
+
+    vector<int> lookup(string_view term) const {
+        auto *list = find(term);
+        return list ? PostingCodec::decode(list) : vector<int>();
+    }
+};
+
+// Writes a segment from terms added in sorted order. Posting lists go to the file as they come, only the dictionary
+// is kept until finish. The file appears under its name once it is complete.
+class SegmentWriter {
+    string path;
+    ofstream out;
+    uint64_t written = 0;
+    vector<TermEntry> entries;
+    string strings;
+    string buffer;
+
+    void write(const void *data, size_t bytes) {
+        out.write((const char*)data, bytes);
+        written += bytes;
+    }
+
+    void align() {
+        static const char padding[8] = {};
+        write(padding, (8 - written % 8) % 8);
+    }
+
+    public:
+    explicit SegmentWriter(const string &path): path(path), out(path + ".tmp", ios::binary) {
+        if (!out) throw runtime_error("Cannot write " + path);
+    }
+
+    void add(string_view term, const vector<int> &docs, const vector<int> &freqs, const vector<uint32_t> &lengths) {
+        buffer.clear();
+        PostingCodec::encode(docs, freqs, lengths, buffer);
+        entries.push_back({written, (uint32_t)strings.size(), (uint32_t)term.size()});
+        strings += term;
+        write(buffer.data(), buffer.size());
+    }
+
+    // `lengths` holds the word counts of docs firstDoc, firstDoc + 1, ...
+    void finish(uint32_t firstDoc, const vector<uint32_t> &lengths) {
+        SegmentFooter footer = {};
+        footer.terms = entries.size();
+        footer.slots = 2;
+        while (footer.slots < 2 * entries.size()) footer.slots *= 2;
+        vector<uint32_t> table(footer.slots);
+        for(size_t i = 0; i < entries.size(); i++) {
+            uint64_t slot = termHash(string_view(strings).substr(entries[i].key, entries[i].length)) & (footer.slots - 1);
+            while (table[slot]) slot = (slot + 1) & (footer.slots - 1);
+            table[slot] = i + 1;
+        }
+        align();
+        footer.entries = written;
+        write(entries.data(), entries.size() * sizeof(TermEntry));
+        footer.strings = written;
+        write(strings.data(), strings.size());
+        align();
+        footer.table = written;
+        write(table.data(), table.size() * sizeof(uint32_t));
+        align();
+        footer.lengths = written;
+        footer.firstDoc = firstDoc;
+        footer.docs = lengths.size();
+        write(lengths.data(), lengths.size() * sizeof(uint32_t));
+        align();
+        footer.magic = SegmentFooter::MAGIC;
+        write(&footer, sizeof footer);
+        out.close();
+        if (!out) throw runtime_error("Cannot write " + path);
+        fs::rename(path + ".tmp", path);
+    }
+};
+
+struct Postings {
+    vector<int> docs;
+    vector<int> freqs;
+};
+
+// Postings of the docs firstDoc, firstDoc + 1, ... and their word counts.
+struct Memtable {
+    unordered_map<string, Postings> terms;
+    uint32_t firstDoc = 0;
+    vector<uint32_t> lengths;
+};
+
+// Calls f with each word of a message: the text between single spaces, an empty word between two spaces, and none
+// after a trailing space, as getline splits it.
+template<class F>
+void forEachWord(string_view message, F f) {
+    for(size_t start = 0; start < message.size(); ) {
+        size_t end = min(message.find(' ', start), message.size());
+        f(message.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
 class FileManager {
     private:
     string base_dir;
@@ -71,125 +625,1079 @@ class FileManager {
         }
     };
 
-    vector<pair<string,int>> storeToFile(const string &filename, const unordered_map<string, vector<int>>& mem_store) {
-        const string path = base_dir + '/' + filename + ".txt";
-        ofstream outfile(path);
-        int cur_offset = 0;
-        vector<pair<string,int>> offsets;
-        for(auto &[key, value] : mem_store) {
-            offsets.push_back({key, cur_offset});
-            outfile << key <<":";
-            bool first = false;
-            for(auto &v : value) {
-                if (first) outfile << ",";
-                first = true;
-                outfile << v;
-            }
-            outfile << "\n";
-            cur_offset++;
-        }
-        
-        outfile.close();
+    string path(const string &filename) const {
+        return base_dir + '/' + filename + ".seg";
+    }
 
-        return offsets;
+    void storeToFile(const string &filename, const Memtable &mem_store) {
+        vector<const pair<const string, Postings>*> sorted;
+        for(auto &entry : mem_store.terms) sorted.push_back(&entry);
+        sort(sorted.begin(), sorted.end(), [](auto *a, auto *b) { return a->first < b->first; });
+        SegmentWriter writer(path(filename));
+        vector<uint32_t> lengths;
+        for(auto *entry : sorted) {
+            lengths.clear();
+            for(int doc : entry->second.docs) lengths.push_back(mem_store.lengths[doc - mem_store.firstDoc]);
+            writer.add(entry->first, entry->second.docs, entry->second.freqs, lengths);
+        }
+        writer.finish(mem_store.firstDoc, mem_store.lengths);
     };
 
-    string readOffset(const string &filename, int offset) {
-        const string path = base_dir + '/' + filename + ".txt";
-        ifstream f(path);
-        string line;
-        int cur_line = 0;
-        while(getline(f, line)) {
-            if (cur_line == offset) return line;
-            cur_line++;
+    // Inverts messages [from, to), doc ids firstDoc, firstDoc + 1, ..., straight into a segment. Words are numbered
+    // as they first appear, pointing into the messages, and each word posts a (word, doc) pair. A counting sort by
+    // the word's rank in sorted order groups the pairs by word with their docs still ascending. Returns the number of
+    // words.
+    uint64_t invertToFile(const string &filename, const vector<string> &messages, size_t from, size_t to, uint32_t firstDoc) {
+        unordered_map<string_view, uint32_t> ids;
+        vector<string_view> words;
+        vector<pair<uint32_t, uint32_t>> run;
+        vector<uint32_t> lengths;
+        for(size_t m = from; m < to; m++) {
+            uint32_t doc = firstDoc + (m - from), count = 0;
+            forEachWord(messages[m], [&](string_view word) {
+                auto [it, added] = ids.try_emplace(word, words.size());
+                if (added) words.push_back(word);
+                run.push_back({it->second, doc});
+                count++;
+            });
+            lengths.push_back(count);
+        }
+        vector<uint32_t> order(words.size()), rank(words.size());
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return words[a] < words[b]; });
+        for(uint32_t r = 0; r < order.size(); r++) rank[order[r]] = r;
+        vector<uint32_t> start(words.size() + 1), docs(run.size());
+        for(auto [word, doc] : run) start[rank[word] + 1]++;
+        partial_sum(start.begin(), start.end(), start.begin());
+        auto fill = start;
+        for(auto [word, doc] : run) docs[fill[rank[word]]++] = doc;
+
+        SegmentWriter writer(path(filename));
+        vector<int> postings, freqs;
+        vector<uint32_t> postingLengths;
+        for(uint32_t r = 0; r < order.size(); r++) {
+            postings.clear();
+            freqs.clear();
+            postingLengths.clear();
+            for(uint32_t i = start[r]; i < start[r + 1]; i++) {
+                if (!postings.empty() and postings.back() == (int)docs[i]) {
+                    freqs.back()++;
+                    continue;
+                }
+                postings.push_back(docs[i]);
+                freqs.push_back(1);
+                postingLengths.push_back(lengths[docs[i] - firstDoc]);
+            }
+            writer.add(words[order[r]], postings, freqs, postingLengths);
+        }
+        writer.finish(firstDoc, lengths);
+        return run.size();
+    }
+
+    // Streaming k-way merge: the sorted dictionaries of the inputs are merged through a heap, and the posting lists
+    // of each term are joined as they come out, so only one term's postings are decoded at a time. The inputs are
+    // adjacent segments, oldest first, so their doc ranges follow each other.
+    void mergeSegments(const vector<shared_ptr<Segment>> &inputs, const string &filename) {
+        SegmentWriter writer(path(filename));
+        using Head = pair<string_view, size_t>;
+        priority_queue<Head, vector<Head>, greater<Head>> terms;
+        vector<size_t> next(inputs.size());
+        for(size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i]->terms()) terms.push({inputs[i]->term(0), i});
+        }
+        vector<int> docs, freqs;
+        vector<uint32_t> lengths;
+        while (!terms.empty()) {
+            string_view term = terms.top().first;
+            docs.clear();
+            freqs.clear();
+            lengths.clear();
+            while (!terms.empty() and terms.top().first == term) {
+                size_t i = terms.top().second;
+                terms.pop();
+                auto *list = inputs[i]->postings(next[i]);
+                auto more = PostingCodec::decode(list);
+                docs.insert(docs.end(), more.begin(), more.end());
+                for(int doc : more) lengths.push_back(inputs[i]->docLength(doc));
+                more = PostingCodec::frequencies(list);
+                freqs.insert(freqs.end(), more.begin(), more.end());
+                if (++next[i] < inputs[i]->terms()) terms.push({inputs[i]->term(next[i]), i});
+            }
+            writer.add(term, docs, freqs, lengths);
         }
+        lengths.clear();
+        for(auto &input : inputs) {
+            assert(input->firstDoc() == inputs[0]->firstDoc() + lengths.size());
+            for(uint32_t doc = input->firstDoc(); doc < input->firstDoc() + input->docs(); doc++) lengths.push_back(input->docLength(doc));
+        }
+        writer.finish(inputs[0]->firstDoc(), lengths);
+    }
+
+    shared_ptr<Segment> openSegment(const string &filename) {
+        return make_shared<Segment>(path(filename));
+    }
+
+    // Drops what a failed write left behind.
+    void remove(const string &filename) {
+        error_code ignored;
+        fs::remove(path(filename) + ".tmp", ignored);
+        fs::remove(path(filename), ignored);
+    }
+};
+
 
-        return "";
+// First position at or after `from` with a doc id >= target: galloping steps, then a binary search.
+static size_t gallop(const vector<int> &docs, size_t from, int target) {
+    size_t step = 1, high = from;
+    while (high < docs.size() and docs[high] < target) {
+        from = high + 1;
+        high += step;
+        step *= 2;
     }
+    return lower_bound(docs.begin() + from, docs.begin() + min(high, docs.size()), target) - docs.begin();
+}
 
+// Messages by sequence number. Messages go into fixed size chunks that never move, so a reader keeps a reference
+// while writers append.
+class MessageStore {
+    static constexpr size_t CHUNK = 1 << 16;
+    vector<unique_ptr<vector<string>>> chunks;
+    size_t count = 0;
+    mutable shared_mutex chunksMutex;
 
+    public:
+    int append(string message) {
+        lock_guard guard(chunksMutex);
+        if (count % CHUNK == 0) {
+            chunks.push_back(make_unique<vector<string>>());
+            chunks.back()->reserve(CHUNK);
+        }
+        chunks.back()->push_back(move(message));
+        return count++;
+    }
+
+    const string &operator[](int seq) const {
+        shared_lock guard(chunksMutex);
+        return (*chunks[seq / CHUNK])[seq % CHUNK];
+    }
+
+    size_t size() const {
+        shared_lock guard(chunksMutex);
+        return count;
+    }
 };
 
+// Doc ids of one term over a segment set and the memtables, ascending. Segments hold increasing doc ranges, oldest
+// first, and the memtables, oldest first, hold the newest docs.
+class TermCursor {
+    vector<PostingCodec::Reader> readers;
+    // Segment of each reader.
+    vector<const Segment*> owners;
+    Postings memory;
+    vector<uint32_t> memoryLengths;
+    size_t current = 0, position = 0, count = 0;
+    // Largest frequency and fewest words over the memory docs, which count as one block.
+    uint32_t memoryMaxFreq = 0, memoryMinLength = UINT32_MAX;
+
+    void settle() {
+        while (current < readers.size() and readers[current].done()) current++;
+    }
+
+    public:
+    static constexpr int END = INT_MAX;
+
+    // `memory` is the term's postings copied out of the memtables, and `lengths` the word counts of their docs.
+    TermCursor(const vector<shared_ptr<Segment>> &segments, const string &term, Postings memory, vector<uint32_t> lengths):
+        memory(move(memory)), memoryLengths(move(lengths)) {
+        for(auto &segment : segments) {
+            if (auto *list = segment->find(term)) {
+                readers.emplace_back(list);
+                owners.push_back(segment.get());
+                count += readers.back().count();
+            }
+        }
+        count += this->memory.docs.size();
+        for(int freq : this->memory.freqs) memoryMaxFreq = max(memoryMaxFreq, (uint32_t)freq);
+        for(uint32_t length : memoryLengths) memoryMinLength = min(memoryMinLength, length);
+        settle();
+    }
+
+    // Document frequency, the cost of walking the whole cursor.
+    size_t cost() const {
+        return count;
+    }
+
+    // Upper bound of weight(frequency, words) over all the docs, and over the block holding the current doc.
+    template<class Weight>
+    double bound(Weight weight) const {
+        double bound = memory.docs.empty() ? 0 : weight(memoryMaxFreq, memoryMinLength);
+        for(auto &reader : readers) bound = max(bound, reader.bound(weight));
+        return bound;
+    }
+
+    template<class Weight>
+    double blockBound(Weight weight) const {
+        if (current < readers.size()) return readers[current].blockBound(weight);
+        return weight(memoryMaxFreq, memoryMinLength);
+    }
+
+    // Last doc id of the block holding the current doc.
+    int blockLast() const {
+        if (current < readers.size()) return readers[current].blockLast();
+        return memory.docs.back();
+    }
+
+    int doc() const {
+        if (current < readers.size()) return readers[current].doc();
+        return position < memory.docs.size() ? memory.docs[position] : END;
+    }
+
+    // Term frequency and word count of the current doc.
+    uint32_t freq() {
+        if (current < readers.size()) return readers[current].freq();
+        return memory.freqs[position];
+    }
+
+    uint32_t length() const {
+        if (current < readers.size()) return owners[current]->docLength(readers[current].doc());
+        return memoryLengths[position];
+    }
+
+    void next() {
+        if (current < readers.size()) {
+            readers[current].next();
+            settle();
+        }
+        else position++;
+    }
+
+    // Moves to the first doc id >= target.
+    void advance(int target) {
+        for(; current < readers.size(); current++) {
+            readers[current].advance(target);
+            if (!readers[current].done()) return;
+        }
+        position = gallop(memory.docs, position, target);
+    }
+};
 
 class IndexManager {
+    public:
+    using SegmentSet = vector<shared_ptr<Segment>>;
+    // Adjacent segments merged at once, and the size ratio between tiers.
+    static constexpr int MERGE_FACTOR = 4;
+    // Messages addMessages inverts into one segment.
+    static constexpr size_t BULK_BATCH = 32768;
+
     private:
-    vector<string> sequenceNumbers;
-    unordered_map<string, vector<int>> mem_store;
+    MessageStore sequenceNumbers;
+    // The memtable taking new messages. Writers hold memtableMutex exclusively, queries share it while they copy
+    // postings out.
+    Memtable mem_store;
+    mutable shared_mutex memtableMutex;
+    // Held by writers, taken before memtableMutex, so a bulk load keeps its doc ids contiguous while queries go on.
+    mutex ingestMutex;
+    // Words over all messages, for BM25. Guarded by memtableMutex.
+    uint64_t totalLength = 0;
     unique_ptr<FileManager> manager;
-    unordered_set<int> filenames;
-    // Map a keyword to a file and an offset.
-    unordered_map<string, vector<pair<int,int>>> disk_cache;
     int capacity;
-    void updateDiskCache(int filename, vector<pair<string, int>> &offsets) {
-        for(auto &[key, offset]: offsets) {
-            disk_cache[key].push_back({filename, offset});
+    // Flushed segments, oldest first. The set is replaced as a whole, a reader keeps searching the set it loaded
+    // while merges swap segments in and out.
+    shared_ptr<const SegmentSet> segments = make_shared<SegmentSet>();
+    // A full memtable being written out. It is searched until its segment replaces it, and a writer filling the
+    // next memtable waits for it. Guarded by segmentsMutex, taken after memtableMutex.
+    shared_ptr<const Memtable> frozen;
+    mutable mutex segmentsMutex;
+    atomic<int> nextSegment = 0;
+    bool background_merge;
+    bool merging = false;
+    bool stopping = false;
+    // The set a merge last failed on, not merged again until the set changes. Guarded by segmentsMutex.
+    shared_ptr<const SegmentSet> failedMerge;
+    // Last background flush or merge error. Guarded by segmentsMutex.
+    string failure;
+    condition_variable mergeWake;
+    condition_variable mergeDone;
+    condition_variable flushWake;
+    condition_variable flushDone;
+    thread merger;
+    thread flusher;
+
+    static int tier(const Segment &segment) {
+        int tier = 0;
+        for(size_t bytes = segment.bytesOnDisk() / 4096; bytes >= MERGE_FACTOR; bytes /= MERGE_FACTOR) tier++;
+        return tier;
+    }
+
+    // First run of MERGE_FACTOR adjacent segments of one size tier. Only adjacent segments are merged, so the set
+    // stays in doc order.
+    static optional<size_t> pickMerge(const SegmentSet &set) {
+        for(size_t from = 0, to = 1; to <= set.size(); to++) {
+            if (to < set.size() and tier(*set[to]) == tier(*set[from])) continue;
+            if (to - from >= MERGE_FACTOR) return from;
+            from = to;
+        }
+        return nullopt;
+    }
+
+    bool mergeable() const {
+        return segments != failedMerge and pickMerge(*segments);
+    }
+
+    // An I/O error keeps the inputs in place, they are searched as before and merged again once a flush adds a
+    // segment.
+    void mergeLoop() {
+        unique_lock guard(segmentsMutex);
+        while (true) {
+            mergeWake.wait(guard, [&] { return stopping or mergeable(); });
+            if (stopping) return;
+            failedMerge = nullptr;
+            auto set = segments;
+            size_t from = *pickMerge(*set);
+            merging = true;
+            guard.unlock();
+            const string filename = "segment" + to_string(nextSegment++);
+            shared_ptr<Segment> merged;
+            try {
+                manager->mergeSegments(SegmentSet(set->begin() + from, set->begin() + from + MERGE_FACTOR), filename);
+                merged = manager->openSegment(filename);
+            }
+            catch (const exception &e) {
+                manager->remove(filename);
+                guard.lock();
+                failure = string("Merge failed: ") + e.what();
+                failedMerge = set;
+                merging = false;
+                mergeDone.notify_all();
+                continue;
+            }
+            guard.lock();
+            // Flushes only append, so the inputs are still at from.
+            auto next = make_shared<SegmentSet>(*segments);
+            for(size_t i = from; i < from + MERGE_FACTOR; i++) (*next)[i]->retire();
+            next->erase(next->begin() + from, next->begin() + from + MERGE_FACTOR);
+            next->insert(next->begin() + from, merged);
+            segments = next;
+            merging = false;
+            mergeDone.notify_all();
+        }
+    }
+
+    // Writes out each frozen memtable and swaps its segment in. A frozen memtable left at shutdown is still written.
+    // If the write fails its messages go back in front of the memtable, where they stay searchable until the next
+    // freeze writes them again.
+    void flushLoop() {
+        unique_lock guard(segmentsMutex);
+        while (true) {
+            flushWake.wait(guard, [&] { return stopping or frozen; });
+            if (!frozen) return;
+            auto table = frozen;
+            guard.unlock();
+            const string filename = "segment" + to_string(nextSegment++);
+            shared_ptr<Segment> segment;
+            try {
+                manager->storeToFile(filename, *table);
+                segment = manager->openSegment(filename);
+            }
+            catch (const exception &e) {
+                manager->remove(filename);
+                unique_lock memtable(memtableMutex);
+                guard.lock();
+                thaw(*table);
+                failure = string("Flush failed: ") + e.what();
+                frozen = nullptr;
+                flushDone.notify_all();
+                mergeDone.notify_all();
+                continue;
+            }
+            guard.lock();
+            auto next = make_shared<SegmentSet>(*segments);
+            next->push_back(segment);
+            segments = next;
+            frozen = nullptr;
+            flushDone.notify_all();
+            mergeDone.notify_all();
+            mergeWake.notify_one();
         }
     }
+
+    // Hands the full memtable to the flusher, once the previous one is written. Called holding ingestMutex but not
+    // memtableMutex: searches go on while it waits, and only writers freeze, so the slot stays free once it is.
+    void freeze() {
+        unique_lock guard(segmentsMutex);
+        flushDone.wait(guard, [&] { return !frozen; });
+        guard.unlock();
+        unique_lock memtable(memtableMutex);
+        guard.lock();
+        frozen = make_shared<const Memtable>(move(mem_store));
+        mem_store = Memtable();
+        mem_store.firstDoc = sequenceNumbers.size();
+        flushWake.notify_one();
+    }
+
+    // Puts the messages of a memtable that failed to flush back in front of the active one. Called holding
+    // memtableMutex.
+    void thaw(const Memtable &table) {
+        Memtable restored = table;
+        for(auto &[term, postings] : mem_store.terms) {
+            auto &into = restored.terms[term];
+            into.docs.insert(into.docs.end(), postings.docs.begin(), postings.docs.end());
+            into.freqs.insert(into.freqs.end(), postings.freqs.begin(), postings.freqs.end());
+        }
+        restored.lengths.insert(restored.lengths.end(), mem_store.lengths.begin(), mem_store.lengths.end());
+        mem_store = move(restored);
+    }
+
+    // What BM25 scores against, read together with the postings.
+    struct Collection {
+        size_t docs = 0;
+        double averageLength = 0;
+    };
+
+    // Cursors for the keywords over the segments, the frozen memtable and the active one. `set` keeps the segments
+    // they read mapped.
+    vector<TermCursor> openCursors(const vector<string> &keywords, shared_ptr<const SegmentSet> &set, Collection *collection = nullptr) const {
+        shared_ptr<const Memtable> flushing;
+        vector<Postings> memory(keywords.size());
+        vector<vector<uint32_t>> lengths(keywords.size());
+        {
+            // No memtable is frozen while the memtable lock is shared, and segments and frozen change together, so
+            // every doc is seen exactly once. Only the memtable postings are copied under the lock.
+            shared_lock memtable(memtableMutex);
+            {
+                lock_guard guard(segmentsMutex);
+                set = segments;
+                flushing = frozen;
+            }
+            for(size_t i = 0; i < keywords.size(); i++) {
+                for(auto *table : {flushing.get(), (const Memtable*)&mem_store}) {
+                    if (!table) continue;
+                    auto it = table->terms.find(keywords[i]);
+                    if (it == table->terms.end()) continue;
+                    auto &[docs, freqs] = it->second;
+                    memory[i].docs.insert(memory[i].docs.end(), docs.begin(), docs.end());
+                    memory[i].freqs.insert(memory[i].freqs.end(), freqs.begin(), freqs.end());
+                    for(int doc : docs) lengths[i].push_back(table->lengths[doc - table->firstDoc]);
+                }
+            }
+            if (collection) {
+                collection->docs = sequenceNumbers.size();
+                collection->averageLength = collection->docs ? (double)totalLength / collection->docs : 0;
+            }
+        }
+        vector<TermCursor> cursors;
+        for(size_t i = 0; i < keywords.size(); i++) cursors.emplace_back(*set, keywords[i], move(memory[i]), move(lengths[i]));
+        return cursors;
+    }
+
     public:
-    IndexManager(int capacity): capacity(capacity), manager(make_unique<FileManager>("Index")) {}
+    IndexManager(int capacity, const string &base_dir = "Index", bool background_merge = true):
+        manager(make_unique<FileManager>(base_dir)), capacity(capacity), background_merge(background_merge) {
+        flusher = thread([this] { flushLoop(); });
+        if (background_merge) merger = thread([this] { mergeLoop(); });
+    }
+
+    ~IndexManager() {
+        {
+            lock_guard guard(segmentsMutex);
+            stopping = true;
+        }
+        flushWake.notify_all();
+        mergeWake.notify_all();
+        flusher.join();
+        if (merger.joinable()) merger.join();
+    }
+
     string getBySequenceNumber(int seq_num) {
         return sequenceNumbers[seq_num];
     };
 
+    // Safe to call from several threads and alongside searches.
     void addWord(const string &message) {
-        int cur_seq_num = sequenceNumbers.size();
-        sequenceNumbers.push_back(message);
-        stringstream ss(message);
-        string keyword;
-        while(getline(ss, keyword, ' ')) {
-            mem_store[keyword].push_back(cur_seq_num);
+        vector<string_view> keywords;
+        forEachWord(message, [&](string_view keyword) { keywords.push_back(keyword); });
+
+        lock_guard ingest(ingestMutex);
+        bool full;
+        {
+            unique_lock memtable(memtableMutex);
+            int cur_seq_num = sequenceNumbers.append(message);
+            for(auto keyword : keywords) {
+                auto &postings = mem_store.terms[string(keyword)];
+                // A word repeated in one message is posted once, with its count.
+                if (postings.docs.empty() or postings.docs.back() != cur_seq_num) {
+                    postings.docs.push_back(cur_seq_num);
+                    postings.freqs.push_back(1);
+                }
+                else postings.freqs.back()++;
+            }
+            mem_store.lengths.push_back(keywords.size());
+            totalLength += keywords.size();
+            full = (int)mem_store.terms.size() >= capacity;
         }
-        
-        if (mem_store.size() >= capacity) {
-            const string filename = to_string(rand());
-            filenames.insert(stoi(filename));
-            auto offsets = manager->storeToFile(filename, mem_store);   
-            updateDiskCache(stoi(filename), offsets);
-            mem_store.clear();
+        if (full) freeze();
+    }
+
+    // Indexes a batch of messages on `threads` threads. Each thread takes BULK_BATCH messages at a time and inverts
+    // them into a segment of its own. The messages and their segments become searchable together once all are
+    // written, after the memtable that was filling is flushed ahead of them.
+    void addMessages(const vector<string> &messages, int threads = max(1u, thread::hardware_concurrency())) {
+        lock_guard ingest(ingestMutex);
+        // Only writers change the memtable and the messages, so they can be read here without memtableMutex.
+        if (!mem_store.lengths.empty()) freeze();
+        uint32_t firstDoc = sequenceNumbers.size();
+        size_t batches = (messages.size() + BULK_BATCH - 1) / BULK_BATCH;
+        SegmentSet written(batches);
+        atomic<size_t> nextBatch = 0;
+        atomic<uint64_t> words = 0;
+        vector<thread> workers;
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([&] {
+                for(size_t b; (b = nextBatch++) < batches; ) {
+                    size_t from = b * BULK_BATCH, to = min(messages.size(), from + BULK_BATCH);
+                    const string filename = "segment" + to_string(nextSegment++);
+                    words += manager->invertToFile(filename, messages, from, to, firstDoc + from);
+                    written[b] = manager->openSegment(filename);
+                }
+            });
         }
+        for(auto &worker : workers) worker.join();
+
+        // The memtable frozen above is flushed first, without holding memtableMutex, so its segment comes before these.
+        {
+            unique_lock guard(segmentsMutex);
+            flushDone.wait(guard, [&] { return !frozen; });
+        }
+        unique_lock memtable(memtableMutex);
+        unique_lock guard(segmentsMutex);
+        // Only a failed flush refills the memtable, its messages would have to come after these segments.
+        if (!mem_store.lengths.empty()) {
+            for(auto &segment : written) segment->retire();
+            throw runtime_error("Cannot add messages, " + failure);
+        }
+        for(auto &message : messages) sequenceNumbers.append(message);
+        totalLength += words;
+        mem_store.firstDoc = sequenceNumbers.size();
+        auto next = make_shared<SegmentSet>(*segments);
+        next->insert(next->end(), written.begin(), written.end());
+        segments = next;
+        mergeWake.notify_one();
     }
 
+    shared_ptr<const SegmentSet> currentSegments() const {
+        lock_guard guard(segmentsMutex);
+        return segments;
+    }
 
-    vector<string> search(const string &keyword) {
-        vector<string> answers;
-        for(auto &v : mem_store[keyword]) {
-            answers.push_back(sequenceNumbers[v]);
+    // Blocks until the frozen memtable is written and the background merger has nothing left to merge.
+    void waitForMerges() {
+        unique_lock guard(segmentsMutex);
+        mergeDone.wait(guard, [&] { return !frozen and !merging and (!background_merge or !mergeable()); });
+    }
+
+    // The last error a background flush or merge hit, empty if there was none.
+    string backgroundError() const {
+        lock_guard guard(segmentsMutex);
+        return failure;
+    }
+
+    enum class Match {
+        // Every keyword.
+        ALL,
+        // Any keyword.
+        ANY,
+        // The keywords next to each other in this order.
+        PHRASE
+    };
+
+    // Matching doc ids in ascending order, at most `limit` of them. ALL walks the rarest keyword and advances the
+    // others to each of its docs, skipping whole blocks, and PHRASE checks the messages ALL finds.
+    vector<int> query(const vector<string> &keywords, Match match = Match::ALL, size_t limit = SIZE_MAX) {
+        vector<int> docs;
+        if (keywords.empty() or limit == 0) return docs;
+        shared_ptr<const SegmentSet> set;
+        auto cursors = openCursors(keywords, set);
+
+        if (match == Match::ANY) {
+            while (docs.size() < limit) {
+                int doc = TermCursor::END;
+                for(auto &cursor : cursors) doc = min(doc, cursor.doc());
+                if (doc == TermCursor::END) break;
+                docs.push_back(doc);
+                for(auto &cursor : cursors) {
+                    if (cursor.doc() == doc) cursor.next();
+                }
+            }
+            return docs;
         }
-        for(auto &[f, offset] : disk_cache[keyword]) {
-            auto line = manager->readOffset(to_string(f), offset);
-            vector<int> sns = Utilities::parseSeqNums(line);
-            for(auto &x : sns) {
-                answers.push_back(sequenceNumbers[x]);
+
+        string phrase;
+        for(auto &keyword : keywords) phrase += (phrase.empty() ? "" : " ") + keyword;
+        sort(cursors.begin(), cursors.end(), [](const TermCursor &a, const TermCursor &b) { return a.cost() < b.cost(); });
+        int doc = cursors[0].doc();
+        while (doc != TermCursor::END and docs.size() < limit) {
+            int next = doc;
+            for(size_t i = 1; i < cursors.size() and next == doc; i++) {
+                cursors[i].advance(doc);
+                next = cursors[i].doc();
+            }
+            if (next != doc) {
+                cursors[0].advance(next);
+                doc = cursors[0].doc();
+                continue;
             }
+            if (match == Match::ALL or containsPhrase(sequenceNumbers[doc], phrase)) docs.push_back(doc);
+            cursors[0].next();
+            doc = cursors[0].doc();
+        }
+        return docs;
+    }
 
+    // Whether the words of `phrase` appear next to each other in the message, as addWord splits it.
+    static bool containsPhrase(const string &message, const string &phrase) {
+        for(size_t at = message.find(phrase); at != string::npos; at = message.find(phrase, at + 1)) {
+            bool starts = at == 0 or message[at - 1] == ' ';
+            bool ends = at + phrase.size() == message.size() or message[at + phrase.size()] == ' ';
+            if (starts and ends) return true;
         }
+        return false;
+    }
+
+    // BM25 parameters.
+    static constexpr double K1 = 1.2, B = 0.75;
 
+    // The k docs scoring highest by BM25 for any of the keywords, best first, with their scores. Ties go to the
+    // older doc. Block-max WAND keeps the cursors in doc order and moves the ones behind up to the first doc whose
+    // keywords' score bounds could beat the k-th best score so far. If the bounds of the blocks holding that doc
+    // cannot, the cursors skip to the end of the first of those blocks without scoring. Without pruning every doc
+    // with a keyword is scored.
+    vector<pair<int, double>> rank(const vector<string> &keywords, size_t k, bool prune = true) const {
+        vector<pair<int, double>> best;
+        if (keywords.empty() or k == 0) return best;
+        shared_ptr<const SegmentSet> set;
+        Collection collection;
+        auto cursors = openCursors(keywords, set, &collection);
+        size_t n = cursors.size();
+        auto weight = [&](double idf, uint32_t freq, uint32_t length) {
+            return idf * freq * (K1 + 1) / (freq + K1 * (1 - B + B * length / collection.averageLength));
+        };
+        // A term's score rises with its frequency and falls with the doc's length, so the largest frequency and
+        // the fewest words of a block bound the scores in it.
+        vector<double> idf(n), bound(n);
+        auto termWeight = [&](size_t i) {
+            return [&, i](uint32_t freq, uint32_t length) { return weight(idf[i], freq, length); };
+        };
+        for(size_t i = 0; i < n; i++) {
+            double df = cursors[i].cost();
+            idf[i] = log(1 + (collection.docs - df + 0.5) / (df + 0.5));
+            bound[i] = cursors[i].bound(termWeight(i));
+        }
+        auto score = [&](int doc) {
+            double total = 0;
+            for(size_t i = 0; i < n; i++) {
+                if (cursors[i].doc() == doc) total += weight(idf[i], cursors[i].freq(), cursors[i].length());
+            }
+            return total;
+        };
+        auto better = [](const pair<int, double> &a, const pair<int, double> &b) {
+            return a.second > b.second or (a.second == b.second and a.first < b.first);
+        };
+        // Heap of the k best so far, the worst of them in front.
+        auto offer = [&](int doc, double score) {
+            if (best.size() == k) {
+                if (!better({doc, score}, best.front())) return;
+                pop_heap(best.begin(), best.end(), better);
+                best.pop_back();
+            }
+            best.push_back({doc, score});
+            push_heap(best.begin(), best.end(), better);
+        };
+
+        vector<size_t> order(n);
+        iota(order.begin(), order.end(), 0);
+        while (true) {
+            sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cursors[a].doc() < cursors[b].doc(); });
+            int first = cursors[order[0]].doc();
+            if (first == TermCursor::END) break;
+            int pivot = first;
+            if (prune) {
+                double threshold = best.size() < k ? -1 : best.front().second, sum = 0;
+                size_t p = 0;
+                while (p < n and cursors[order[p]].doc() != TermCursor::END and (sum += bound[order[p]]) <= threshold) p++;
+                if (p == n or cursors[order[p]].doc() == TermCursor::END) break;
+                pivot = cursors[order[p]].doc();
+                if (first != pivot) {
+                    for(size_t j = 0; j < p; j++) cursors[order[j]].advance(pivot);
+                    continue;
+                }
+                // Docs up to the end of the first block to end only hold keywords the cursors at the pivot have.
+                double blocks = 0;
+                int skipTo = TermCursor::END;
+                for(size_t i = 0; i < n; i++) {
+                    if (cursors[i].doc() == pivot) {
+                        blocks += cursors[i].blockBound(termWeight(i));
+                        skipTo = min(skipTo, cursors[i].blockLast() + 1);
+                    }
+                    else skipTo = min(skipTo, cursors[i].doc());
+                }
+                if (blocks <= threshold) {
+                    for(auto &cursor : cursors) {
+                        if (cursor.doc() == pivot) cursor.advance(skipTo);
+                    }
+                    continue;
+                }
+            }
+            offer(pivot, score(pivot));
+            for(auto &cursor : cursors) {
+                if (cursor.doc() == pivot) cursor.next();
+            }
+        }
+        sort_heap(best.begin(), best.end(), better);
+        return best;
+    }
+
+    vector<string> searchRanked(const vector<string> &keywords, size_t k) {
+        vector<string> answers;
+        for(auto &[doc, score] : rank(keywords, k)) answers.push_back(sequenceNumbers[doc]);
         return answers;
     }
 
-    vector<string> search(const vector<string> &keywords) {
-        int total_keywords = keywords.size();
-        unordered_map<string, int> freq;
-        for(auto &keyword : keywords) {
-            for(auto &[f, offset] : disk_cache[keyword]) {
-                vector<int> sns = Utilities::parseSeqNums(manager->readOffset(to_string(f), offset));
-                for(auto &x : sns) {
-                    freq[sequenceNumbers[x]]++;
-                }
-    
-            } 
-        } 
+    vector<string> search(const string &keyword) {
+        return search(vector<string>({keyword}));
+    }
+
+    vector<string> search(const vector<string> &keywords, Match match = Match::ALL, size_t limit = SIZE_MAX) {
         vector<string> answers;
-        for(auto &[k,v] : freq) {
-            if (v == total_keywords)
-                answers.push_back(k);
+        for(int doc : query(keywords, match, limit)) {
+            answers.push_back(sequenceNumbers[doc]);
         }
 
         return answers;
     }
 };
 
+// Posting lists with Zipf distributed lengths in the old text lines and in the binary format: bytes on disk and
+// postings decoded per second.
+void benchmarkPostings() {
+    constexpr int DOCS = 1000000, TERMS = 4000;
+    mt19937 gen(7);
+    vector<vector<int>> lists;
+    size_t postings = 0;
+    for(int t = 0; t < TERMS; t++) {
+        int df = max(1, 500000 / (t + 1));
+        vector<int> docs;
+        for(int doc = gen() % (DOCS / df); doc < DOCS and (int)docs.size() < df; doc += 1 + gen() % (2 * DOCS / df)) docs.push_back(doc);
+        postings += docs.size();
+        lists.push_back(move(docs));
+    }
+    vector<string> lines;
+    size_t textBytes = 0, binaryBytes = 0;
+    for(size_t t = 0; t < lists.size(); t++) {
+        string line = "term" + to_string(t) + ":";
+        for(size_t i = 0; i < lists[t].size(); i++) line += (i ? "," : "") + to_string(lists[t][i]);
+        textBytes += line.size() + 1;
+        lines.push_back(move(line));
+    }
+    string encoded;
+    vector<size_t> offsets;
+    for(auto &docs : lists) {
+        offsets.push_back(encoded.size());
+        PostingCodec::encode(docs, vector<int>(docs.size(), 1), vector<uint32_t>(docs.size(), 1), encoded);
+    }
+    binaryBytes = encoded.size();
+
+    auto rate = [&](auto decode) {
+        auto begin = chrono::steady_clock::now();
+        size_t decoded = 0;
+        for(size_t t = 0; t < lists.size(); t++) {
+            auto docs = decode(t);
+            assert(docs == lists[t]);
+            decoded += docs.size();
+        }
+        return decoded / chrono::duration<double>(chrono::steady_clock::now() - begin).count() / 1e6;
+    };
+    double text = rate([&](size_t t) { return Utilities::parseSeqNums(lines[t]); });
+    double scalar = rate([&](size_t t) { return PostingCodec::decode(encoded.data() + offsets[t], false); });
+    double simd = rate([&](size_t t) { return PostingCodec::decode(encoded.data() + offsets[t], true); });
+
+    cout << "\n" << postings << " postings in " << TERMS << " terms" << endl;
+    cout << "text: " << textBytes / 1024 << " KiB, parse " << text << "M postings/s" << endl;
+    cout << "binary: " << binaryBytes / 1024 << " KiB, decode scalar " << scalar << "M postings/s, SSE2 " << simd << "M postings/s" << endl;
+}
+
+
+// Latency of finding one term in every segment: scanning text segments to the term's line as the first version did,
+// and the hashed dictionary of mapped segment files. Each segment holds a random half of the terms.
+void benchmarkLookup() {
+    constexpr int TERMS = 20000, QUERIES = 20;
+    string dir = (fs::temp_directory_path() / "inverted_search_lookup").string();
+    fs::remove_all(dir);
+    FileManager files(dir);
+    mt19937 gen(11);
+    vector<shared_ptr<Segment>> segments;
+    vector<unordered_map<string, int>> lines;
+    cout << "\nTerm lookup" << endl;
+    for(int count : {1, 4, 16, 64}) {
+        while ((int)segments.size() < count) {
+            Memtable store;
+            store.lengths.assign(TERMS, 2);
+            for(int t = 0; t < TERMS; t++) {
+                if (gen() % 2) store.terms["term" + to_string(t)] = {{(int)segments.size(), t}, {1, 1}};
+            }
+            string name = "segment" + to_string(segments.size());
+            files.storeToFile(name, store);
+            segments.push_back(files.openSegment(name));
+            ofstream text(dir + "/" + name + ".txt");
+            auto &line = lines.emplace_back();
+            for(auto &[key, postings] : store.terms) {
+                line[key] = line.size();
+                text << key << ":" << postings.docs[0] << "," << postings.docs[1] << "\n";
+            }
+        }
+        vector<string> queries;
+        for(int q = 0; q < QUERIES; q++) queries.push_back("term" + to_string(gen() % TERMS));
+
+        auto begin = chrono::steady_clock::now();
+        size_t scanned = 0;
+        for(auto &query : queries) {
+            for(int s = 0; s < count; s++) {
+                auto it = lines[s].find(query);
+                if (it == lines[s].end()) continue;
+                ifstream f(dir + "/segment" + to_string(s) + ".txt");
+                string line;
+                for(int l = 0; getline(f, line) and l < it->second; l++) {}
+                scanned += Utilities::parseSeqNums(line).size();
+            }
+        }
+        double scanUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count() / QUERIES;
+
+        begin = chrono::steady_clock::now();
+        size_t found = 0;
+        for(int round = 0; round < 1000; round++) {
+            for(auto &query : queries) {
+                for(auto &segment : segments) found += segment->lookup(query).size();
+            }
+        }
+        double lookupUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count() / QUERIES / 1000;
+        assert(found == scanned * 1000);
+        cout << count << " segments of ~" << TERMS / 2 << " terms: line scan " << scanUs << "us, dictionary " << lookupUs << "us per term" << endl;
+    }
+    segments.clear();
+    fs::remove_all(dir);
+}
+
+
+// Messages of words drawn from a Zipf vocabulary, as searches over a skewed collection see them.
+vector<string> zipfMessages(int count, int vocabulary, int words, unsigned seed) {
+    vector<double> weights;
+    for(int r = 0; r < vocabulary; r++) weights.push_back(1.0 / (r + 1));
+    discrete_distribution<int> word(weights.begin(), weights.end());
+    mt19937 gen(seed);
+    vector<string> messages;
+    for(int i = 0; i < count; i++) {
+        string message;
+        for(int w = 0; w < words; w++) message += (w ? " w" : "w") + to_string(word(gen));
+        messages.push_back(move(message));
+    }
+    return messages;
+}
+
+// Segment count and single term search latency after ingesting the same messages without merging and with the
+// background merger.
+void benchmarkMerging() {
+    auto messages = zipfMessages(200000, 50000, 8, 13);
+    cout << "\nIngest " << messages.size() << " messages" << endl;
+    for(bool background : {false, true}) {
+        string dir = (fs::temp_directory_path() / "inverted_search_merge").string();
+        fs::remove_all(dir);
+        double ingestSeconds, searchUs;
+        size_t segments, hits = 0;
+        {
+            IndexManager index(4000, dir, background);
+            auto begin = chrono::steady_clock::now();
+            for(auto &message : messages) index.addWord(message);
+            index.waitForMerges();
+            ingestSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            segments = index.currentSegments()->size();
+            begin = chrono::steady_clock::now();
+            for(int r = 100; r < 1100; r++) hits += index.search("w" + to_string(r)).size();
+            searchUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count() / 1000;
+        }
+        fs::remove_all(dir);
+        cout << (background ? "tiered merges: " : "no merges: ") << segments << " segments, ingest " << (size_t)(messages.size() / ingestSeconds)
+             << " messages/s, search " << searchUs << "us per term (" << hits << " hits)" << endl;
+    }
+}
+
+
+// Conjunctions over a Zipf collection as the first version answered them, every posting turned into its message and
+// counted in a map, against intersecting doc ids from the rarest term. Then OR, phrase and top 10 queries.
+void benchmarkQueries() {
+    auto messages = zipfMessages(200000, 50000, 8, 17);
+    string dir = (fs::temp_directory_path() / "inverted_search_queries").string();
+    fs::remove_all(dir);
+    {
+        IndexManager index(4000, dir);
+        for(auto &message : messages) index.addWord(message);
+        index.waitForMerges();
+        auto set = index.currentSegments();
+        auto legacy = [&](const vector<string> &keywords) {
+            unordered_map<string, int> freq;
+            for(auto &keyword : keywords) {
+                for(auto &segment : *set) {
+                    for(auto &x : segment->lookup(keyword)) freq[index.getBySequenceNumber(x)]++;
+                }
+            }
+            size_t found = 0;
+            for(auto &[message, count] : freq) found += count == (int)keywords.size();
+            return found;
+        };
+        auto time = [](auto f) {
+            auto begin = chrono::steady_clock::now();
+            auto result = f();
+            return make_pair(result, chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count());
+        };
+
+        cout << "\nQueries over " << messages.size() << " messages in " << set->size() << " segments" << endl;
+        vector<vector<string>> conjunctions = {{"w0", "w1"}, {"w0", "w2000"}, {"w1", "w5", "w30"}, {"w3", "w40000"}};
+        for(auto &keywords : conjunctions) {
+            auto [flushed, legacyUs] = time([&] { return legacy(keywords); });
+            auto [docs, queryUs] = time([&] { return index.query(keywords); });
+            size_t expected = count_if(messages.begin(), messages.end(), [&](const string &message) {
+                return all_of(keywords.begin(), keywords.end(), [&](const string &keyword) { return IndexManager::containsPhrase(message, keyword); });
+            });
+            // The legacy search never looked at the memtable.
+            assert(docs.size() == expected and flushed <= expected);
+            string name;
+            for(auto &keyword : keywords) name += (name.empty() ? "" : " AND ") + keyword;
+            cout << name << ": " << docs.size() << " docs, message counting " << legacyUs << "us, intersection " << queryUs << "us" << endl;
+        }
+        auto [any, anyUs] = time([&] { return index.query({"w100", "w200", "w300"}, IndexManager::Match::ANY); });
+        auto [phrase, phraseUs] = time([&] { return index.query({"w0", "w1"}, IndexManager::Match::PHRASE); });
+        auto [top, topUs] = time([&] { return index.query({"w0", "w1"}, IndexManager::Match::ALL, 10); });
+        cout << "w100 OR w200 OR w300: " << any.size() << " docs " << anyUs << "us, \"w0 w1\": " << phrase.size() << " docs "
+             << phraseUs << "us, top 10 of w0 AND w1: " << topUs << "us" << endl;
+    }
+    fs::remove_all(dir);
+}
+
+
+// Top 10 BM25 queries scoring every doc with a keyword against WAND, over messages of 4 and 12 words.
+void benchmarkRanking() {
+    auto messages = zipfMessages(100000, 50000, 4, 23), longer = zipfMessages(100000, 50000, 12, 29);
+    messages.insert(messages.end(), longer.begin(), longer.end());
+    shuffle(messages.begin(), messages.end(), mt19937(31));
+    string dir = (fs::temp_directory_path() / "inverted_search_ranking").string();
+    fs::remove_all(dir);
+    {
+        IndexManager index(4000, dir);
+        for(auto &message : messages) index.addWord(message);
+        index.waitForMerges();
+        cout << "\nTop 10 by BM25 over " << messages.size() << " messages" << endl;
+        vector<vector<string>> queries = {{"w0", "w1"}, {"w0", "w1", "w2", "w3"}, {"w0", "w5", "w300"}, {"w1", "w20", "w4000"}, {"w2", "w9000", "w30000"}, {"w10", "w100", "w1000"}};
+        for(auto &keywords : queries) {
+            auto begin = chrono::steady_clock::now();
+            auto exhaustive = index.rank(keywords, 10, false);
+            double exhaustiveUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+            begin = chrono::steady_clock::now();
+            auto pruned = index.rank(keywords, 10);
+            double wandUs = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+            assert(pruned == exhaustive);
+            string name;
+            for(auto &keyword : keywords) name += (name.empty() ? "" : " ") + keyword;
+            cout << name << ": exhaustive " << exhaustiveUs << "us, WAND " << wandUs << "us (" << exhaustiveUs / wandUs << "x)" << endl;
+        }
+    }
+    fs::remove_all(dir);
+}
+
+// Messages indexed per second one at a time through addWord and in bulk with a growing number of threads. The
+// bulk indexes must answer like the first one.
+void benchmarkBulkIndexing() {
+    auto messages = zipfMessages(400000, 50000, 8, 37);
+    vector<vector<string>> queries = {{"w0"}, {"w7", "w300"}, {"w20000"}};
+    vector<vector<int>> expected;
+    cout << "\nIndex " << messages.size() << " messages" << endl;
+    for(int threads : {0, 1, 2, 4, 8}) {
+        string dir = (fs::temp_directory_path() / "inverted_search_bulk").string();
+        fs::remove_all(dir);
+        double seconds;
+        size_t segments;
+        {
+            IndexManager index(4000, dir);
+            auto begin = chrono::steady_clock::now();
+            if (threads) index.addMessages(messages, threads);
+            else {
+                for(auto &message : messages) index.addWord(message);
+            }
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            index.waitForMerges();
+            segments = index.currentSegments()->size();
+            for(size_t q = 0; q < queries.size(); q++) {
+                auto docs = index.query(queries[q]);
+                if (threads) assert(docs == expected[q]);
+                else expected.push_back(docs);
+            }
+            assert(index.rank({"w7", "w300"}, 10) == index.rank({"w7", "w300"}, 10, false));
+        }
+        fs::remove_all(dir);
+        cout << (threads ? "bulk, " + to_string(threads) + " threads: " : "addWord: ") << (size_t)(messages.size() / seconds)
+             << " docs/s, " << segments << " segments after merging" << endl;
+    }
+}
 
+// One writer ingesting while reader threads run conjunctions, first with one lock around the whole index as the
+// single threaded manager needed, then with concurrent indexing and searching.
+void benchmarkConcurrency() {
+    auto messages = zipfMessages(200000, 50000, 8, 19);
+    vector<vector<string>> queries;
+    for(int q = 0; q < 64; q++) queries.push_back({"w" + to_string(q % 8), "w" + to_string(10 + q * 7)});
+    cout << "\nIngest " << messages.size() << " messages while searching" << endl;
+    for(bool locked : {true, false}) {
+        for(int readers : {0, 1, 2, 4}) {
+            string dir = (fs::temp_directory_path() / "inverted_search_concurrency").string();
+            fs::remove_all(dir);
+            double ingestSeconds;
+            atomic<size_t> answered = 0;
+            {
+                IndexManager index(4000, dir);
+                mutex global;
+                atomic<bool> writing = true;
+                vector<thread> threads;
+                for(int r = 0; r < readers; r++) {
+                    threads.emplace_back([&, r] {
+                        for(size_t q = r; writing; q++) {
+                            if (locked) {
+                                lock_guard guard(global);
+                                index.query(queries[q % queries.size()]);
+                            }
+                            else index.query(queries[q % queries.size()]);
+                            answered++;
+                        }
+                    });
+                }
+                auto begin = chrono::steady_clock::now();
+                for(auto &message : messages) {
+                    if (locked) {
+                        lock_guard guard(global);
+                        index.addWord(message);
+                    }
+                    else index.addWord(message);
+                }
+                ingestSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+                writing = false;
+                for(auto &reader : threads) reader.join();
+                index.waitForMerges();
+                assert(index.query({"w0"}).size() == (size_t)count_if(messages.begin(), messages.end(), [](const string &message) {
+                    return IndexManager::containsPhrase(message, "w0");
+                }));
+            }
+            fs::remove_all(dir);
+            cout << (locked ? "global lock, " : "concurrent, ") << readers << " readers: ingest " << (size_t)(messages.size() / ingestSeconds)
+                 << " messages/s, " << (size_t)(answered / ingestSeconds) << " queries/s" << endl;
+        }
+    }
+}
 
 
 int main() {
@@ -242,8 +1750,126 @@ int main() {
     assert(spanishResults.size() == 1);
     assert(spanishResults[0] == "Hola is the Hello in Spanish");
 
+    // Test 8: Any keyword, in message order and limited
+    auto anyResults = i.search(vector<string>({"Alice", "Bob"}), IndexManager::Match::ANY);
+    assert(anyResults.size() == 4);
+    assert(anyResults[0] == "Hello my name is Alice");
+    assert(anyResults[3] == "Bob enjoys system design");
+    assert(i.search(vector<string>({"Alice", "Bob"}), IndexManager::Match::ANY, 2).size() == 2);
+
+    // Test 9: Phrase queries need the words next to each other in order
+    auto phraseResults = i.search(vector<string>({"is", "the", "Hello"}), IndexManager::Match::PHRASE);
+    assert(phraseResults.size() == 2);
+    assert(phraseResults[0] == "Hola is the Hello in Spanish");
+    assert(i.search(vector<string>({"Hello", "the"}), IndexManager::Match::PHRASE).empty());
+
+    // Test 10: Messages still in memory are searched with the flushed ones
+    i.addWord("Alice meets Bob");
+    auto memoryResults = i.search(vector<string>({"Bob", "Alice"}));
+    assert(memoryResults.size() == 1);
+    assert(memoryResults[0] == "Alice meets Bob");
+
+    // Test 11: Writers and a reader at once, every message found once and in order
+    {
+        string dir = (fs::temp_directory_path() / "inverted_search_concurrent").string();
+        fs::remove_all(dir);
+        {
+            IndexManager shared(50, dir);
+            atomic<bool> writing = true;
+            thread reader([&] {
+                while (writing) {
+                    auto docs = shared.query({"common"});
+                    assert(is_sorted(docs.begin(), docs.end()) and adjacent_find(docs.begin(), docs.end()) == docs.end());
+                }
+            });
+            vector<thread> writers;
+            for(int w = 0; w < 4; w++) {
+                writers.emplace_back([&, w] {
+                    for(int m = 0; m < 500; m++) shared.addWord("common writer" + to_string(w) + " word" + to_string(m));
+                });
+            }
+            for(auto &writer : writers) writer.join();
+            writing = false;
+            reader.join();
+            assert(shared.query({"common"}).size() == 2000);
+            assert(shared.search(vector<string>({"writer2", "word7"})).size() == 1);
+        }
+        fs::remove_all(dir);
+    }
+
+    // Test 12: Ranked search, messages with both keywords first, then the rarer keyword in the shorter message
+    auto rankedResults = i.searchRanked({"Alice", "Hello"}, 3);
+    assert(rankedResults.size() == 3);
+    assert(rankedResults[0] == "Hello my name is Alice");
+    assert(rankedResults[1] == "Alice meets Bob");
+    assert(rankedResults[2] == "Alice loves data structures");
+    assert(i.rank({"Alice", "Hello"}, 3) == i.rank({"Alice", "Hello"}, 3, false));
+
+    // Test 13: A word repeated in a message counts towards its score
+    i.addWord("Spanish lessons Spanish");
+    auto spanishRanked = i.searchRanked({"Spanish"}, 2);
+    assert(spanishRanked[0] == "Spanish lessons Spanish");
+    assert(spanishRanked[1] == "Hola is the Hello in Spanish");
+
+    // Test 14: Bulk loaded messages come after the ones before them and before the ones after
+    i.addMessages({"Bulk Alice one", "Bulk Bob two", "Bulk  Alice"}, 2);
+    i.addWord("Alice after bulk");
+    auto bulkResults = i.search("Alice");
+    assert(bulkResults.size() == 6);
+    assert(bulkResults[2] == "Alice meets Bob");
+    assert(bulkResults[3] == "Bulk Alice one");
+    assert(bulkResults[4] == "Bulk  Alice");
+    assert(bulkResults[5] == "Alice after bulk");
+    assert(i.search(vector<string>({"Bulk", "Bob"})).size() == 1);
+    assert(i.rank({"Bulk", "Alice"}, 4) == i.rank({"Bulk", "Alice"}, 4, false));
+
+    // Test 15: A merge or a flush that fails in the background keeps every message searchable, and both resume once
+    // the directory can be written again
+    {
+        string dir = (fs::temp_directory_path() / "inverted_search_failures").string();
+        fs::remove_all(dir);
+        {
+            IndexManager failing(2, dir);
+            // Two words fill the memtable, so each message is flushed to a segment of its own.
+            int added = 0;
+            auto add = [&] {
+                failing.addWord("kept w" + to_string(added++));
+                failing.waitForMerges();
+            };
+            do add(); while (failing.currentSegments()->size() != 3);
+            // The next flush adds a fourth segment and the merge writes the name after it, a directory there fails it.
+            int last = 0;
+            for(auto &entry : fs::directory_iterator(dir)) last = max(last, stoi(entry.path().stem().string().substr(7)));
+            fs::create_directory(dir + "/segment" + to_string(last + 2) + ".seg.tmp");
+            add();
+            assert(failing.backgroundError().starts_with("Merge failed"));
+            assert(failing.currentSegments()->size() == 4);
+            fs::remove_all(dir);
+            add();
+            add();
+            assert(failing.backgroundError().starts_with("Flush failed"));
+            assert(failing.currentSegments()->size() == 4);
+            assert((int)failing.query({"kept"}).size() == added);
+            fs::create_directory(dir);
+            add();
+            auto kept = failing.search("kept");
+            assert((int)kept.size() == added);
+            for(int m = 0; m < added; m++) assert(kept[m] == "kept w" + to_string(m));
+            assert(failing.currentSegments()->size() < 4);
+        }
+        fs::remove_all(dir);
+    }
+
     // If all tests pass
     cout << "✅ All test cases passed!" << endl;
 
+    benchmarkPostings();
+    benchmarkLookup();
+    benchmarkMerging();
+    benchmarkQueries();
+    benchmarkRanking();
+    benchmarkBulkIndexing();
+    benchmarkConcurrency();
+
     return 0;
 }
\ No newline at end of file